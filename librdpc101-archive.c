@@ -0,0 +1,493 @@
+/*
+ * Long-term RSSI archive for SUNTAC RDPC101.
+ *
+ * A state hook collects every decoded status report per device into an
+ * open block: timestamp, sig_intensity, freq and the stereo indicator.
+ * A block is written out once it holds RDPC101_ARC_SAMPLES samples or
+ * spans ARC_FLUSH_US, as one appended header and a column-compressed
+ * payload (see librdpc101-priv.h).  The header carries the time range,
+ * serial number, freq range and RSSI aggregates, so rdpc-archive can
+ * skip or summarise a block without decoding it.  Each block also gets
+ * an entry in the sidecar index, which rdpc-archive binary-searches for
+ * a time window instead of walking the archive.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "rdpc101.h"
+#include "librdpc101-priv.h"
+
+#define ARC_FLUSH_US	(60 * 1000000ULL)
+/* worst case: 10-byte varints, 1 + 4 bytes of bit columns per sample */
+#define ARC_PAYLOAD_MAX	(RDPC101_ARC_SAMPLES * 16)
+
+struct arc_dev {
+	char serial[RDPC101_SERIAL_MAX];
+	int n;
+	uint64_t t[RDPC101_ARC_SAMPLES];
+	int32_t freq[RDPC101_ARC_SAMPLES];
+	uint8_t rssi[RDPC101_ARC_SAMPLES];
+	uint8_t stereo[RDPC101_ARC_SAMPLES];
+};
+
+static pthread_mutex_t arc_lock = PTHREAD_MUTEX_INITIALIZER;
+static int arc_fd = -1;
+static int arc_idx_fd = -1;
+static uint64_t arc_size;		/* where the next block goes */
+static uint64_t arc_t_max;		/* greatest t_last written */
+static uint64_t arc_last_t;		/* of the last sample taken */
+static struct arc_dev **arc_devs;	/* by device index */
+static int arc_ndev;
+static int arc_failed;
+static uint8_t arc_buf[ARC_PAYLOAD_MAX];
+
+struct arc_bits {
+	uint8_t *p;
+	unsigned long pos;		/* in bits */
+};
+
+static void arc_put_bits(struct arc_bits *w, uint32_t v, int bits)
+{
+	for (; bits > 0; bits--, v >>= 1, w->pos++)
+		if (v & 1)
+			w->p[w->pos >> 3] |= 1 << (w->pos & 7);
+}
+
+static size_t arc_put_varint(uint8_t *p, uint64_t v)
+{
+	size_t n = 0;
+
+	while (v >= 0x80)
+	{
+		p[n++] = v | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+	return n;
+}
+
+static int arc_bits_for(uint32_t range)
+{
+	int bits = 0;
+
+	while (bits < 32 && (range >> bits))
+		bits++;
+	return bits;
+}
+
+static void arc_index_fill(struct rdpc101_arc_index *e,
+		const struct rdpc101_arc_block *h, uint64_t offset)
+{
+	memset(e, 0, sizeof *e);
+	e->offset = offset;
+	e->t_first = h->t_first;
+	e->t_last = h->t_last;
+	if (h->t_last > arc_t_max)
+		arc_t_max = h->t_last;
+	e->t_max = arc_t_max;
+	e->t_floor = h->t_first;
+	e->freq_min = h->freq_min;
+	e->freq_max = h->freq_max;
+	memcpy(e->serial, h->serial, sizeof e->serial);
+}
+
+/*
+ * Index the block just written at offset.  Every block written later is
+ * open now or starts later, so the floor is the oldest open block.
+ */
+static void arc_index(const struct rdpc101_arc_block *h, uint64_t offset)
+{
+	struct rdpc101_arc_index e;
+	int i;
+
+	if (arc_idx_fd < 0)
+		return;
+	arc_index_fill(&e, h, offset);
+	for (i = 0; i < arc_ndev; i++)
+		if (arc_devs[i] && arc_devs[i]->n > 0 && arc_devs[i]->t[0] < e.t_floor)
+			e.t_floor = arc_devs[i]->t[0];
+	if (write(arc_idx_fd, &e, sizeof e) != sizeof e)
+	{
+		/* the next open indexes what is missing */
+		perror("archive index");
+		close(arc_idx_fd);
+		arc_idx_fd = -1;
+	}
+}
+
+/* called with arc_lock held */
+static void arc_flush(struct arc_dev *d)
+{
+	struct rdpc101_arc_block h;
+	struct arc_bits w;
+	struct iovec iov[2];
+	size_t len = 0;
+	int64_t prev = 0;
+	int i;
+
+	if (d->n == 0)
+		return;
+	if (arc_failed)
+	{
+		/* a torn block must stay last; the next open cuts it off */
+		d->n = 0;
+		return;
+	}
+	memset(&h, 0, sizeof h);
+	memcpy(h.magic, RDPC101_ARC_BLOCK_MAGIC, sizeof h.magic);
+	memcpy(h.serial, d->serial, sizeof h.serial);
+	h.t_first = d->t[0];
+	h.t_last = d->t[d->n - 1];
+	h.count = d->n;
+	h.rssi_min = h.rssi_max = d->rssi[0];
+	h.freq_min = h.freq_max = d->freq[0];
+	for (i = 0; i < d->n; i++)
+	{
+		h.rssi_sum += d->rssi[i];
+		h.stereo += d->stereo[i];
+		if (d->rssi[i] < h.rssi_min)
+			h.rssi_min = d->rssi[i];
+		if (d->rssi[i] > h.rssi_max)
+			h.rssi_max = d->rssi[i];
+		if (d->freq[i] < h.freq_min)
+			h.freq_min = d->freq[i];
+		if (d->freq[i] > h.freq_max)
+			h.freq_max = d->freq[i];
+	}
+	h.rssi_bits = arc_bits_for(h.rssi_max - h.rssi_min);
+	h.freq_bits = arc_bits_for(h.freq_max - h.freq_min);
+
+	for (i = 1; i < d->n; i++)
+	{
+		int64_t delta = d->t[i] - d->t[i - 1];
+		int64_t dod = delta - prev;
+
+		len += arc_put_varint(arc_buf + len,
+				((uint64_t) dod << 1) ^ (uint64_t) (dod >> 63));
+		prev = delta;
+	}
+	memset(arc_buf + len, 0, sizeof arc_buf - len);
+	w.p = arc_buf + len;
+	w.pos = 0;
+	for (i = 0; i < d->n; i++)
+		arc_put_bits(&w, d->rssi[i] - h.rssi_min, h.rssi_bits);
+	w.pos = (w.pos + 7) & ~7UL;
+	for (i = 0; i < d->n; i++)
+		arc_put_bits(&w, d->freq[i] - h.freq_min, h.freq_bits);
+	w.pos = (w.pos + 7) & ~7UL;
+	for (i = 0; i < d->n; i++)
+		arc_put_bits(&w, d->stereo[i], 1);
+	len += (w.pos + 7) >> 3;
+	h.bytes = len;
+
+	iov[0].iov_base = &h;
+	iov[0].iov_len = sizeof h;
+	iov[1].iov_base = arc_buf;
+	iov[1].iov_len = len;
+	if (writev(arc_fd, iov, 2) != (ssize_t) (sizeof h + len))
+	{
+		perror("archive");
+		arc_failed = TRUE;
+	}
+	else
+	{
+		arc_index(&h, arc_size);
+		arc_size += sizeof h + len;
+	}
+	d->n = 0;
+}
+
+static struct arc_dev *arc_dev(struct rdpc101_dev *rp)
+{
+	struct arc_dev *d;
+
+	if (rp->index >= arc_ndev)
+	{
+		struct arc_dev **np;
+		int n = rp->index + 1;
+
+		if ((np = realloc(arc_devs, n * sizeof *np)) == NULL)
+			return NULL;
+		memset(np + arc_ndev, 0, (n - arc_ndev) * sizeof *np);
+		arc_devs = np;
+		arc_ndev = n;
+	}
+	if ((d = arc_devs[rp->index]) == NULL)
+	{
+		if ((d = calloc(1, sizeof *d)) == NULL)
+			return NULL;
+		if (rp->dev && rp->dev->serial_number && *rp->dev->serial_number)
+			snprintf(d->serial, sizeof d->serial, "%ls",
+					rp->dev->serial_number);
+		else
+			snprintf(d->serial, sizeof d->serial, "#%d", rp->index);
+		arc_devs[rp->index] = d;
+	}
+	return d;
+}
+
+static void arc_hook(struct rdpc101_dev *rp, void *arg)
+{
+	struct arc_dev *d;
+	struct timespec ts;
+	uint64_t t;
+
+	if (rp->cur.ma & RDPC_MA_SEEKING_MASK)
+		return;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	t = (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+	pthread_mutex_lock(&arc_lock);
+	if (arc_fd >= 0 && (d = arc_dev(rp)) != NULL)
+	{
+		/* hold the time while a clock stepped back catches up */
+		if (t < arc_last_t)
+			t = arc_last_t;
+		arc_last_t = t;
+		if (d->n > 0 && (d->n == RDPC101_ARC_SAMPLES
+				|| t - d->t[0] >= ARC_FLUSH_US))
+			arc_flush(d);
+		d->t[d->n] = t;
+		d->freq[d->n] = rp->cur.freq;
+		d->rssi[d->n] = rp->cur.sig_intensity;
+		d->stereo[d->n] = (rp->cur.ma & RDPC_MA_STEREO) != 0;
+		d->n++;
+	}
+	pthread_mutex_unlock(&arc_lock);
+}
+
+/*
+ * Bring the archive and its index in step: trust the index up to its
+ * last entry, index the complete blocks after it, and cut off anything
+ * after the last one, since a block torn by a crash or a full disk
+ * would hide every block appended after it.
+ */
+static int arc_recover(int fd, int ifd, const char *path, size_t size)
+{
+	struct rdpc101_arc_index last, *add = NULL, *np;
+	char magic[sizeof RDPC101_ARC_INDEX_MAGIC - 1];
+	struct rdpc101_arc_block h;
+	const uint8_t *base;
+	long nent, nadd = 0, cap = 0, i;
+	size_t off, end;
+	struct stat st;
+	uint64_t floor;
+	int ret = -1;
+
+	base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED)
+	{
+		perror(path);
+		return -1;
+	}
+	if (memcmp(base, RDPC101_ARC_MAGIC, sizeof RDPC101_ARC_MAGIC - 1) != 0)
+	{
+		fprintf(stderr, "%s: not an archive\n", path);
+		goto out;
+	}
+	end = sizeof RDPC101_ARC_MAGIC - 1;
+	arc_t_max = 0;
+	if (fstat(ifd, &st) < 0)
+		goto fail;
+	nent = st.st_size < sizeof magic ? 0
+			: (st.st_size - sizeof magic) / sizeof last;
+	if (nent > 0 && (pread(ifd, magic, sizeof magic, 0) != sizeof magic
+			|| memcmp(magic, RDPC101_ARC_INDEX_MAGIC, sizeof magic) != 0
+			|| pread(ifd, &last, sizeof last,
+					sizeof magic + (nent - 1) * sizeof last) != sizeof last
+			|| last.offset < end
+			|| rdpc101_arc_header(base, size, last.offset, &h) < 0
+			|| h.t_first != last.t_first))
+		nent = 0;
+	if (nent > 0)
+	{
+		end = last.offset + sizeof h + h.bytes;
+		arc_t_max = last.t_max;
+	}
+	/* drop a torn entry, or start the index over */
+	if (ftruncate(ifd, nent > 0 ? sizeof magic + nent * sizeof last : 0) < 0
+			|| (nent == 0 && write(ifd, RDPC101_ARC_INDEX_MAGIC, sizeof magic)
+					!= sizeof magic))
+		goto fail;
+
+	for (off = end; (off = rdpc101_arc_resync(base, size, off, &h)) < size;
+			off = end)
+	{
+		if (nadd == cap)
+		{
+			cap = cap ? cap * 2 : 64;
+			if ((np = realloc(add, cap * sizeof *add)) == NULL)
+				goto fail;
+			add = np;
+		}
+		arc_index_fill(&add[nadd++], &h, off);
+		end = off + sizeof h + h.bytes;
+	}
+	for (floor = UINT64_MAX, i = nadd - 1; i >= 0; i--)
+	{
+		if (add[i].t_first < floor)
+			floor = add[i].t_first;
+		add[i].t_floor = floor;
+	}
+	if (nadd > 0 && write(ifd, add, nadd * sizeof *add)
+			!= (ssize_t) (nadd * sizeof *add))
+		goto fail;
+
+	if (end < size)
+	{
+		fprintf(stderr, "%s: dropping %lu bytes of a torn block\n", path,
+				(unsigned long) (size - end));
+		if (ftruncate(fd, end) < 0)
+			goto fail;
+	}
+	arc_size = end;
+	arc_last_t = arc_t_max;
+	ret = 0;
+	goto out;
+fail:
+	perror(path);
+out:
+	free(add);
+	munmap((void *) base, size);
+	return ret;
+}
+
+/*
+ * Append every status report read from now on to the archive at path,
+ * creating it if needed, and keep its index in path.idx.
+ */
+int rdpc101_archive_open(const char *path)
+{
+	char ipath[PATH_MAX];
+	struct stat st;
+	int fd, ifd;
+
+	if (arc_fd >= 0)
+		return -1;
+	if (snprintf(ipath, sizeof ipath, "%s" RDPC101_ARC_INDEX_SUFFIX, path)
+			>= sizeof ipath)
+	{
+		errno = ENAMETOOLONG;
+		perror(path);
+		return -1;
+	}
+	if ((fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) < 0
+			|| fstat(fd, &st) < 0)
+	{
+		perror(path);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	if (st.st_size == 0)
+	{
+		if (write(fd, RDPC101_ARC_MAGIC, sizeof RDPC101_ARC_MAGIC - 1)
+				!= sizeof RDPC101_ARC_MAGIC - 1)
+		{
+			perror(path);
+			close(fd);
+			return -1;
+		}
+		st.st_size = sizeof RDPC101_ARC_MAGIC - 1;
+	}
+	else if (st.st_size < sizeof RDPC101_ARC_MAGIC - 1)
+	{
+		fprintf(stderr, "%s: not an archive\n", path);
+		close(fd);
+		return -1;
+	}
+	if ((ifd = open(ipath, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) < 0)
+	{
+		perror(ipath);
+		close(fd);
+		return -1;
+	}
+	if (arc_recover(fd, ifd, path, st.st_size) < 0
+			|| rdpc101_add_state_hook(arc_hook, NULL) < 0)
+	{
+		close(ifd);
+		close(fd);
+		return -1;
+	}
+	pthread_mutex_lock(&arc_lock);
+	arc_fd = fd;
+	arc_idx_fd = ifd;
+	arc_failed = FALSE;
+	pthread_mutex_unlock(&arc_lock);
+	return 0;
+}
+
+/*
+ * Write out the open blocks and stop archiving.
+ */
+void rdpc101_archive_close(void)
+{
+	int i;
+
+	if (arc_fd < 0)
+		return;
+	rdpc101_del_state_hook(arc_hook, NULL);
+	pthread_mutex_lock(&arc_lock);
+	for (i = 0; i < arc_ndev; i++)
+		if (arc_devs[i])
+		{
+			arc_flush(arc_devs[i]);
+			free(arc_devs[i]);
+		}
+	free(arc_devs);
+	arc_devs = NULL;
+	arc_ndev = 0;
+	close(arc_fd);
+	arc_fd = -1;
+	if (arc_idx_fd >= 0)
+		close(arc_idx_fd);
+	arc_idx_fd = -1;
+	pthread_mutex_unlock(&arc_lock);
+}
+
+/*-
+ * Copyright (c) 2009 NISHIO Yasuhiro <nishio@hh.iij4u.or.jp>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
@@ -0,0 +1,234 @@
+/*
+ * Linux hidraw backend for SUNTAC RDPC101.
+ *
+ * Talks to /dev/hidrawN directly: input reports with read(2), commands
+ * with the HIDIOCSFEATURE ioctl.  The device node is found from the
+ * hidapi path when hidapi itself uses hidraw, otherwise by matching
+ * vendor, product and serial in /sys/class/hidraw.  Unlike hidapi this
+ * gives every device a file descriptor that can be waited on.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+#include <sys/types.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "rdpc101.h"
+#include "librdpc101-priv.h"
+
+#if defined(HAVE_LINUX_HIDRAW_H)
+#include <sys/ioctl.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+/*
+ * <linux/hidraw.h> drags in <linux/hid.h>, whose enum hid_report_type
+ * collides with the one in rdpc101.h; only this ioctl is needed.
+ */
+#if !defined(HIDIOCSFEATURE)
+#define HIDIOCSFEATURE(len)	_IOC(_IOC_WRITE|_IOC_READ, 'H', 0x06, len)
+#endif
+
+#define HIDRAW_SYSFS	"/sys/class/hidraw"
+#define HIDRAW_PATH_MAX	300
+
+int rdpc101_hidraw_available(void)
+{
+	return TRUE;
+}
+
+/*
+ * Does /sys/class/hidraw/<name>/device/uevent describe this device?
+ */
+static int hidraw_match(const char *name, const char *serial)
+{
+	char path[HIDRAW_PATH_MAX + 32], line[128], id[32];
+	int found_id = FALSE, found_serial = serial == NULL;
+	FILE *fp;
+
+	snprintf(path, sizeof path, HIDRAW_SYSFS "/%s/device/uevent", name);
+	if ((fp = fopen(path, "r")) == NULL)
+		return FALSE;
+	snprintf(id, sizeof id, "HID_ID=%04X:%08X:%08X", 3, RDPC101_VENDORID,
+			RDPC101_PRODUCTID);
+	while (fgets(line, sizeof line, fp))
+	{
+		line[strcspn(line, "\n")] = '\0';
+		if (strcasecmp(line, id) == 0)
+			found_id = TRUE;
+		else if (serial && strncmp(line, "HID_UNIQ=", 9) == 0
+				&& strcmp(line + 9, serial) == 0)
+			found_serial = TRUE;
+	}
+	fclose(fp);
+	return found_id && found_serial;
+}
+
+static int hidraw_find(struct rdpc101_dev *rp, char *node, int size)
+{
+	char serial[RDPC101_SERIAL_MAX], *sp = NULL;
+	struct dirent *de;
+	DIR *dir;
+
+	if (rp->dev->path && strncmp(rp->dev->path, "/dev/hidraw", 11) == 0)
+	{
+		snprintf(node, size, "%s", rp->dev->path);
+		return 0;
+	}
+	if (rp->dev->serial_number && *rp->dev->serial_number
+			&& wcstombs(serial, rp->dev->serial_number, sizeof serial)
+					!= (size_t) -1)
+	{
+		serial[sizeof serial - 1] = '\0';
+		sp = serial;
+	}
+	if ((dir = opendir(HIDRAW_SYSFS)) == NULL)
+		return -1;
+	while ((de = readdir(dir)) != NULL)
+	{
+		if (strncmp(de->d_name, "hidraw", 6) != 0
+				|| !hidraw_match(de->d_name, sp))
+			continue;
+		snprintf(node, size, "/dev/%s", de->d_name);
+		closedir(dir);
+		return 0;
+	}
+	closedir(dir);
+	return -1;
+}
+
+int rdpc101_hidraw_open(struct rdpc101_dev *rp)
+{
+	char node[HIDRAW_PATH_MAX];
+
+	if (hidraw_find(rp, node, sizeof node) < 0)
+	{
+		fprintf(stderr, "open: no hidraw node for %ls\n",
+				rp->dev->serial_number ? rp->dev->serial_number : L"?");
+		return -1;
+	}
+	if ((rp->fd = open(node, O_RDWR | O_NONBLOCK | O_CLOEXEC)) < 0)
+	{
+		perror(node);
+		return -1;
+	}
+	return 0;
+}
+
+void rdpc101_hidraw_close(struct rdpc101_dev *rp)
+{
+	close(rp->fd);
+	rp->fd = -1;
+}
+
+/*
+ * Same contract as hid_read_timeout(): bytes read, 0 on timeout (or a
+ * signal), -1 on error.
+ */
+int rdpc101_hidraw_read(struct rdpc101_dev *rp, unsigned char *buf, int size,
+		int timeout_ms)
+{
+	struct pollfd pfd;
+	ssize_t n;
+
+	if ((n = read(rp->fd, buf, size)) >= 0)
+		return n;
+	if (errno != EAGAIN && errno != EINTR)
+		return -1;
+	if (timeout_ms == 0)
+		return 0;
+	pfd.fd = rp->fd;
+	pfd.events = POLLIN;
+	switch (poll(&pfd, 1, timeout_ms))
+	{
+	case -1:
+		return errno == EINTR ? 0 : -1;
+	case 0:
+		return 0;
+	}
+	if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+		return -1;
+	if ((n = read(rp->fd, buf, size)) < 0)
+		return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+	return n;
+}
+
+int rdpc101_hidraw_send_feature(struct rdpc101_dev *rp,
+		const unsigned char *data, int size)
+{
+	unsigned char buf[RDPC101_REPORT_BUF];
+
+	if (size > sizeof buf)
+		return -1;
+	memcpy(buf, data, size);
+	return ioctl(rp->fd, HIDIOCSFEATURE(size), buf);
+}
+
+#else
+
+int rdpc101_hidraw_available(void)
+{
+	return FALSE;
+}
+
+int rdpc101_hidraw_open(struct rdpc101_dev *rp)
+{
+	return -1;
+}
+
+void rdpc101_hidraw_close(struct rdpc101_dev *rp)
+{
+}
+
+int rdpc101_hidraw_read(struct rdpc101_dev *rp, unsigned char *buf, int size,
+		int timeout_ms)
+{
+	return -1;
+}
+
+int rdpc101_hidraw_send_feature(struct rdpc101_dev *rp,
+		const unsigned char *data, int size)
+{
+	return -1;
+}
+
+#endif
+
+/*-
+ * Copyright (c) 2009 NISHIO Yasuhiro <nishio@hh.iij4u.or.jp>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
@@ -0,0 +1,310 @@
+/*
+ * Anomaly logging for SUNTAC RDPC101.
+ *
+ * Unusual packets seen on the status read path are copied into a
+ * preallocated ring and written out by a background thread, so a
+ * misbehaving device cannot stall polling on stderr.  Per device,
+ * every anomaly is counted, back-to-back repeats of the same packet
+ * are folded into a repeat count, and what remains is rate limited by
+ * a token bucket; folded and suppressed packets are reported with the
+ * next line written for that device.
+ */
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "rdpc101.h"
+
+#define LOG_RING_SIZE	64
+#define LOG_PACKET_MAX	32
+#define LOG_LINE_MAX	(32 + LOG_PACKET_MAX * 3 + 64)
+
+struct log_record {
+	const char *label;
+	const wchar_t *serial;
+	unsigned long repeats;		/* of this device's previous record */
+	unsigned long suppressed;	/* by the rate limit since then */
+	int size;
+	unsigned char data[LOG_PACKET_MAX];
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t idle;
+	pthread_t thread;
+	int running;
+	int busy;
+	int stop;
+	unsigned head, tail;		/* tail - head records are queued */
+	unsigned long dropped;		/* ring was full */
+	struct log_record ring[LOG_RING_SIZE];
+} logq = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+		PTHREAD_COND_INITIALIZER };
+
+static int verbose_level = 0;
+
+void rdpc101_set_verbose(int level)
+{
+	verbose_level = level;
+}
+
+int rdpc101_verbose(void)
+{
+	return verbose_level;
+}
+
+static uint64_t log_now_ms(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t) t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+static uint32_t log_hash(const unsigned char *p, int size)
+{
+	uint32_t h = 2166136261u;
+
+	while (size-- > 0)
+		h = (h ^ *p++) * 16777619u;
+	return h;
+}
+
+static void log_write(const struct log_record *r)
+{
+	char line[LOG_LINE_MAX];
+	int n, i;
+
+	if (r->repeats)
+		fprintf(stderr, "%10s: previous packet repeated %lu times\n",
+				"", r->repeats);
+	if (!r->label)
+		return;
+	n = snprintf(line, sizeof line, "%10s:", r->label);
+	for (i = 0; i < r->size && n < sizeof line; i++)
+		n += snprintf(line + n, sizeof line - n, " %2.2x", r->data[i]);
+	if (r->suppressed && n < sizeof line)
+		n += snprintf(line + n, sizeof line - n, " (%lu suppressed)",
+				r->suppressed);
+	if (r->serial && n < sizeof line)
+		n += snprintf(line + n, sizeof line - n, " [%ls]", r->serial);
+	fprintf(stderr, "%s\n", line);
+}
+
+static void *log_writer(void *arg)
+{
+	pthread_mutex_lock(&logq.lock);
+	for (;;)
+	{
+		struct log_record r;
+		unsigned long dropped;
+
+		while (logq.head == logq.tail && !logq.stop)
+			pthread_cond_wait(&logq.work, &logq.lock);
+		if (logq.head == logq.tail)
+			break;
+		r = logq.ring[logq.head++ % LOG_RING_SIZE];
+		dropped = logq.dropped;
+		logq.dropped = 0;
+		logq.busy = TRUE;
+		pthread_mutex_unlock(&logq.lock);
+
+		if (dropped)
+			fprintf(stderr, "%10s: %lu records dropped\n", "log", dropped);
+		log_write(&r);
+
+		pthread_mutex_lock(&logq.lock);
+		logq.busy = FALSE;
+		if (logq.head == logq.tail)
+			pthread_cond_broadcast(&logq.idle);
+	}
+	pthread_cond_broadcast(&logq.idle);
+	pthread_mutex_unlock(&logq.lock);
+	return NULL;
+}
+
+/* called with logq.lock held */
+static void log_enqueue(const struct log_record *r)
+{
+	if (!logq.running && !logq.stop)
+	{
+		if (pthread_create(&logq.thread, NULL, log_writer, NULL) != 0)
+		{
+			/* no writer; keep the caller going, write in place */
+			log_write(r);
+			return;
+		}
+		logq.running = TRUE;
+	}
+	if (logq.tail - logq.head >= LOG_RING_SIZE)
+	{
+		logq.dropped++;
+		return;
+	}
+	logq.ring[logq.tail++ % LOG_RING_SIZE] = *r;
+	pthread_cond_signal(&logq.work);
+}
+
+/* refill the token bucket; called with logq.lock held */
+static int log_take_token(struct rdpc101_log_state *ls)
+{
+	uint64_t now = log_now_ms();
+	uint64_t refill;
+
+	if (ls->stamp_ms == 0)
+	{
+		ls->tokens = RDPC101_LOG_BURST;
+		ls->stamp_ms = now;
+	}
+	refill = (now - ls->stamp_ms) * RDPC101_LOG_RATE / 1000;
+	if (refill > 0)
+	{
+		ls->tokens = ls->tokens + refill > RDPC101_LOG_BURST ?
+				RDPC101_LOG_BURST : ls->tokens + refill;
+		ls->stamp_ms = now;
+	}
+	if (ls->tokens == 0)
+		return FALSE;
+	ls->tokens--;
+	return TRUE;
+}
+
+/*
+ * Record an anomalous packet.  rp may be NULL for packets that do not
+ * belong to a device; those are neither folded nor rate limited.
+ */
+void rdpc101_log_packet(struct rdpc101_dev *rp, const char *label,
+		const unsigned char *p, int size)
+{
+	struct log_record r;
+	struct rdpc101_log_state *ls;
+	uint32_t hash;
+
+	if (verbose_level < 0)
+	{
+		if (rp)
+			rp->log.anomalies++;
+		return;
+	}
+	if (size > LOG_PACKET_MAX)
+		size = LOG_PACKET_MAX;
+	r.label = label;
+	r.serial = NULL;
+	r.repeats = 0;
+	r.suppressed = 0;
+	r.size = size;
+	memcpy(r.data, p, size);
+	hash = log_hash(p, size);
+
+	pthread_mutex_lock(&logq.lock);
+	if (rp)
+	{
+		ls = &rp->log;
+		ls->anomalies++;
+		if (ls->last_hash == hash && ls->last_size == size)
+		{
+			ls->repeats++;
+			pthread_mutex_unlock(&logq.lock);
+			return;
+		}
+		if (!log_take_token(ls))
+		{
+			ls->suppressed++;
+			pthread_mutex_unlock(&logq.lock);
+			return;
+		}
+		ls->last_hash = hash;
+		ls->last_size = size;
+		r.serial = rp->dev ? rp->dev->serial_number : NULL;
+		r.repeats = ls->repeats;
+		r.suppressed = ls->suppressed;
+		ls->repeats = 0;
+		ls->suppressed = 0;
+	}
+	log_enqueue(&r);
+	pthread_mutex_unlock(&logq.lock);
+}
+
+/*
+ * Write out what is pending for rp (a trailing repeat count) and wait
+ * for the writer to drain.
+ */
+void rdpc101_log_flush(struct rdpc101_dev *rp)
+{
+	pthread_mutex_lock(&logq.lock);
+	if (rp && (rp->log.repeats || rp->log.suppressed))
+	{
+		struct log_record r;
+
+		memset(&r, 0, sizeof r);
+		r.repeats = rp->log.repeats;
+		if (rp->log.suppressed)
+		{
+			r.label = "log";
+			r.suppressed = rp->log.suppressed;
+			r.serial = rp->dev ? rp->dev->serial_number : NULL;
+		}
+		rp->log.repeats = 0;
+		rp->log.suppressed = 0;
+		log_enqueue(&r);
+	}
+	while (logq.running && (logq.head != logq.tail || logq.busy))
+		pthread_cond_wait(&logq.idle, &logq.lock);
+	pthread_mutex_unlock(&logq.lock);
+}
+
+void rdpc101_log_stop(void)
+{
+	pthread_mutex_lock(&logq.lock);
+	if (!logq.running)
+	{
+		pthread_mutex_unlock(&logq.lock);
+		return;
+	}
+	logq.stop = TRUE;
+	pthread_cond_signal(&logq.work);
+	pthread_mutex_unlock(&logq.lock);
+	pthread_join(logq.thread, NULL);
+
+	pthread_mutex_lock(&logq.lock);
+	logq.running = FALSE;
+	logq.stop = FALSE;
+	pthread_mutex_unlock(&logq.lock);
+}
+
+/*-
+ * Copyright (c) 2009 NISHIO Yasuhiro <nishio@hh.iij4u.or.jp>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
@@ -0,0 +1,199 @@
+/*
+ * Internal interfaces shared between the librdpc101 sources.
+ */
+#if !defined(__LIBRDPC101_PRIV_H)
+#define __LIBRDPC101_PRIV_H
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include "rdpc101.h"
+
+/*
+ * USDT probes, provider "rdpc101".  Without --enable-usdt they expand to
+ * nothing and their arguments are not evaluated; with it each is a nop
+ * instruction plus an ELF note until a tracer attaches.
+ */
+#if defined(ENABLE_USDT)
+#include <sys/sdt.h>
+#define RDPC101_PROBE1(name, a)		DTRACE_PROBE1(rdpc101, name, a)
+#define RDPC101_PROBE2(name, a, b)	DTRACE_PROBE2(rdpc101, name, a, b)
+#define RDPC101_PROBE3(name, a, b, c)	DTRACE_PROBE3(rdpc101, name, a, b, c)
+#define RDPC101_PROBE5(name, a, b, c, d, e) \
+	DTRACE_PROBE5(rdpc101, name, a, b, c, d, e)
+#else
+#define RDPC101_PROBE1(name, a)			do {} while (0)
+#define RDPC101_PROBE2(name, a, b)		do {} while (0)
+#define RDPC101_PROBE3(name, a, b, c)		do {} while (0)
+#define RDPC101_PROBE5(name, a, b, c, d, e)	do {} while (0)
+#endif
+
+/*
+ * librdpc101-recorder.c: flight recorder file layout, shared with
+ * rdpc-recdump.  A slot is valid when seq != 0 and
+ * (seq - 1) % nslots is its own index; seq is stored last.
+ */
+#define RDPC101_REC_MAGIC	"RDPCREC1"
+#define RDPC101_REC_DATA	32
+
+enum rdpc101_rec_kind {
+    RDPC101_REC_FEATURE = 1,	/* feature report sent */
+    RDPC101_REC_INPUT		/* input (status) report read */
+};
+
+struct rdpc101_rec_header {
+    char magic[8];
+    uint32_t slot_size;
+    uint32_t nslots;
+    _Atomic uint64_t next;	/* sequence number of the next record */
+    unsigned char pad[40];
+};
+
+struct rdpc101_rec_slot {
+    _Atomic uint64_t seq;	/* record number + 1, 0 while written */
+    uint64_t t_ns;		/* CLOCK_REALTIME */
+    int32_t dev;
+    int32_t result;
+    uint8_t kind;
+    uint8_t size;		/* of the report, data holds the first bytes */
+    unsigned char pad[6];
+    unsigned char data[RDPC101_REC_DATA];
+};
+
+void rdpc101_record_slow(struct rdpc101_dev *rp, enum rdpc101_rec_kind kind,
+		const unsigned char *data, int size, int result);
+extern struct rdpc101_rec_header *rdpc101_rec;
+
+/* one predictable branch when no recorder is open */
+#define rdpc101_record(rp, kind, data, size, result)			\
+    do {								\
+	if (rdpc101_rec)						\
+	    rdpc101_record_slow(rp, kind, data, size, result);		\
+    } while (0)
+
+/*
+ * librdpc101-archive.c: RSSI archive layout, shared with rdpc-archive.
+ * The file is RDPC101_ARC_MAGIC followed by blocks, each a header and
+ * its payload.  Archive time never goes backwards.  Payload columns,
+ * in order, for count samples:
+ *	time	zigzag varints: t[1] - t[0], then deltas of deltas
+ *	rssi	rssi_bits each, value - rssi_min
+ *	freq	freq_bits each, value - freq_min
+ *	stereo	1 bit each
+ * Bit columns are packed LSB first, each from a byte boundary.  A
+ * damaged stretch is skipped by looking for the next valid header.
+ */
+#define RDPC101_ARC_MAGIC	"RDPCARC1"
+#define RDPC101_ARC_BLOCK_MAGIC	"RDPB"
+#define RDPC101_ARC_SAMPLES	1024	/* per block, at most */
+
+struct rdpc101_arc_block {
+    char magic[4];
+    uint32_t bytes;		/* of payload after the header */
+    uint64_t t_first;		/* us since the epoch */
+    uint64_t t_last;
+    uint32_t count;
+    uint32_t rssi_sum;
+    uint32_t stereo;		/* samples with the stereo indicator */
+    int32_t freq_min;
+    int32_t freq_max;
+    uint8_t rssi_min;
+    uint8_t rssi_max;
+    uint8_t rssi_bits;
+    uint8_t freq_bits;
+    char serial[RDPC101_SERIAL_MAX];
+};
+
+/*
+ * The index is a sidecar file, the archive path plus
+ * RDPC101_ARC_INDEX_SUFFIX: RDPC101_ARC_INDEX_MAGIC, then one entry per
+ * block in archive order.  Neither t_max nor t_floor ever decreases, so
+ * the entries for a time window are found by binary search.  Blocks
+ * past the one named by the last entry have no entry yet.
+ */
+#define RDPC101_ARC_INDEX_MAGIC		"RDPCIDX1"
+#define RDPC101_ARC_INDEX_SUFFIX	".idx"
+
+struct rdpc101_arc_index {
+    uint64_t offset;		/* of the block header in the archive */
+    uint64_t t_first;
+    uint64_t t_last;
+    uint64_t t_max;		/* greatest t_last of this and earlier blocks */
+    uint64_t t_floor;		/* no later block starts before this */
+    int32_t freq_min;
+    int32_t freq_max;
+    char serial[RDPC101_SERIAL_MAX];
+};
+
+/* copy the header at off of a size-byte archive into h; -1 if invalid */
+static inline int rdpc101_arc_header(const uint8_t *base, size_t size,
+		size_t off, struct rdpc101_arc_block *h)
+{
+	if (off + sizeof *h > size)
+		return -1;
+	memcpy(h, base + off, sizeof *h);	/* not aligned in the file */
+	if (memcmp(h->magic, RDPC101_ARC_BLOCK_MAGIC, sizeof h->magic) != 0
+			|| h->count == 0 || h->count > RDPC101_ARC_SAMPLES
+			|| h->t_last < h->t_first || h->bytes > size - off - sizeof *h)
+		return -1;
+	h->serial[sizeof h->serial - 1] = '\0';
+	return 0;
+}
+
+/* offset of the first valid block at or after off, or size */
+static inline size_t rdpc101_arc_resync(const uint8_t *base, size_t size,
+		size_t off, struct rdpc101_arc_block *h)
+{
+	for (; off < size; off++)
+		if (base[off] == RDPC101_ARC_BLOCK_MAGIC[0]
+				&& rdpc101_arc_header(base, size, off, h) == 0)
+			break;
+	return off < size ? off : size;
+}
+
+/* librdpc101.c */
+int rdpc101_cancel_fd(void);
+void rdpc101_cancel_drain(void);
+
+/* librdpc101-hidraw.c */
+int rdpc101_hidraw_available(void);
+int rdpc101_hidraw_open(struct rdpc101_dev *rp);
+void rdpc101_hidraw_close(struct rdpc101_dev *rp);
+int rdpc101_hidraw_read(struct rdpc101_dev *rp, unsigned char *buf, int size,
+		int timeout_ms);
+int rdpc101_hidraw_send_feature(struct rdpc101_dev *rp,
+		const unsigned char *data, int size);
+
+#endif
+
+/*-
+ * Copyright (c) 2009 NISHIO Yasuhiro <nishio@hh.iij4u.or.jp>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
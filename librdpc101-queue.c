@@ -0,0 +1,235 @@
+/*
+ * Per-device command queue for SUNTAC RDPC101.
+ *
+ * Holds at most one pending command of each kind.  A new command of a
+ * kind that is still pending replaces it (latest wins), so the command
+ * the caller cares about, the last one, never waits behind superseded
+ * ones.  A worker thread sends pending commands oldest first, except
+ * that a pending band change always goes out before a frequency.
+ *
+ * In real-time mode the worker runs with the rdpc101_rt_start() settings.
+ *
+ * Do not mix queued and direct rdpc101_set_* calls on one device.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include "rdpc101.h"
+
+struct rdpc101_cmdq {
+	struct rdpc101_dev *rp;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t idle;
+	unsigned pending;		/* bitmask of 1 << enum rdpc101_qcmd */
+	int busy;
+	int stop;
+	int value[RDPC101_Q_NCMDS];
+	unsigned long seq[RDPC101_Q_NCMDS];
+	unsigned long next_seq;
+	struct rdpc101_queue_stats stats;
+};
+
+static int cmdq_send(struct rdpc101_dev *rp, enum rdpc101_qcmd cmd, int value)
+{
+	switch (cmd)
+	{
+	case RDPC101_Q_BAND:
+		return rdpc101_set_band(rp, value);
+	case RDPC101_Q_FREQ:
+		return rdpc101_set_freq(rp, value);
+	case RDPC101_Q_MA:
+		return rdpc101_set_ma(rp, value);
+	case RDPC101_Q_MUTE:
+		return rdpc101_mute(rp, value);
+	default:
+		return -1;
+	}
+}
+
+/* called with q->lock held and q->pending != 0 */
+static enum rdpc101_qcmd cmdq_pick(struct rdpc101_cmdq *q)
+{
+	int i, best = -1;
+
+	if (q->pending & (1 << RDPC101_Q_BAND))
+		return RDPC101_Q_BAND;
+	for (i = 0; i < RDPC101_Q_NCMDS; i++)
+		if ((q->pending & (1 << i)) && (best < 0 || q->seq[i] < q->seq[best]))
+			best = i;
+	return best;
+}
+
+static void *cmdq_worker(void *arg)
+{
+	struct rdpc101_cmdq *q = arg;
+
+	/* best effort; rdpc101_rt_start() already reported what was refused */
+	rdpc101_rt_thread();
+	pthread_mutex_lock(&q->lock);
+	for (;;)
+	{
+		enum rdpc101_qcmd cmd;
+		int value, ret;
+
+		while (!q->pending && !q->stop)
+			pthread_cond_wait(&q->work, &q->lock);
+		if (!q->pending)
+			break;
+
+		cmd = cmdq_pick(q);
+		value = q->value[cmd];
+		q->pending &= ~(1 << cmd);
+		q->busy = TRUE;
+		pthread_mutex_unlock(&q->lock);
+
+		ret = cmdq_send(q->rp, cmd, value);
+
+		pthread_mutex_lock(&q->lock);
+		q->busy = FALSE;
+		if (ret < 0)
+			q->stats.failed++;
+		else
+			q->stats.sent++;
+		if (!q->pending)
+			pthread_cond_broadcast(&q->idle);
+	}
+	pthread_cond_broadcast(&q->idle);
+	pthread_mutex_unlock(&q->lock);
+	return NULL;
+}
+
+int rdpc101_queue_start(struct rdpc101_dev *rp)
+{
+	struct rdpc101_cmdq *q;
+
+	if (rp->cmdq)
+		return 0;
+	if ((q = calloc(1, sizeof *q)) == NULL)
+		return -1;
+	q->rp = rp;
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->work, NULL);
+	pthread_cond_init(&q->idle, NULL);
+	if (pthread_create(&q->thread, NULL, cmdq_worker, q) != 0)
+	{
+		pthread_cond_destroy(&q->idle);
+		pthread_cond_destroy(&q->work);
+		pthread_mutex_destroy(&q->lock);
+		free(q);
+		return -1;
+	}
+	rp->cmdq = q;
+	return 0;
+}
+
+/*
+ * Sends whatever is still pending, then joins the worker.
+ */
+void rdpc101_queue_stop(struct rdpc101_dev *rp)
+{
+	struct rdpc101_cmdq *q = rp->cmdq;
+
+	if (!q)
+		return;
+	pthread_mutex_lock(&q->lock);
+	q->stop = TRUE;
+	pthread_cond_signal(&q->work);
+	pthread_mutex_unlock(&q->lock);
+	pthread_join(q->thread, NULL);
+
+	pthread_cond_destroy(&q->idle);
+	pthread_cond_destroy(&q->work);
+	pthread_mutex_destroy(&q->lock);
+	free(q);
+	rp->cmdq = NULL;
+}
+
+int rdpc101_queue_submit(struct rdpc101_dev *rp, enum rdpc101_qcmd cmd,
+		int value)
+{
+	struct rdpc101_cmdq *q = rp->cmdq;
+
+	if (!q || cmd < 0 || cmd >= RDPC101_Q_NCMDS)
+		return -1;
+	pthread_mutex_lock(&q->lock);
+	q->stats.submitted++;
+	if (q->pending & (1 << cmd))
+		q->stats.coalesced++;
+	/* a frequency queued for the old band is meaningless after a switch */
+	if (cmd == RDPC101_Q_BAND && (q->pending & (1 << RDPC101_Q_FREQ))
+			&& rdpc101_band(q->value[RDPC101_Q_FREQ]) != value)
+	{
+		q->pending &= ~(1 << RDPC101_Q_FREQ);
+		q->stats.coalesced++;
+	}
+	q->value[cmd] = value;
+	q->seq[cmd] = q->next_seq++;
+	q->pending |= 1 << cmd;
+	pthread_cond_signal(&q->work);
+	pthread_mutex_unlock(&q->lock);
+	return 0;
+}
+
+/*
+ * Waits until every submitted command has been sent or dropped.
+ */
+int rdpc101_queue_flush(struct rdpc101_dev *rp)
+{
+	struct rdpc101_cmdq *q = rp->cmdq;
+
+	if (!q)
+		return -1;
+	pthread_mutex_lock(&q->lock);
+	while ((q->pending || q->busy) && !q->stop)
+		pthread_cond_wait(&q->idle, &q->lock);
+	pthread_mutex_unlock(&q->lock);
+	return 0;
+}
+
+int rdpc101_queue_stats(struct rdpc101_dev *rp,
+		struct rdpc101_queue_stats *stats)
+{
+	struct rdpc101_cmdq *q = rp->cmdq;
+
+	if (!q)
+		return -1;
+	pthread_mutex_lock(&q->lock);
+	*stats = q->stats;
+	pthread_mutex_unlock(&q->lock);
+	return 0;
+}
+
+/*-
+ * Copyright (c) 2009 NISHIO Yasuhiro <nishio@hh.iij4u.or.jp>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
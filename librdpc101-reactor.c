@@ -0,0 +1,312 @@
+/*
+ * Single-threaded epoll reactor for SUNTAC RDPC101 (hidraw backend).
+ *
+ * One thread waits on the hidraw descriptors of every added device and
+ * on an eventfd.  Status reports are decoded into rp->cur and handed to
+ * the callback as they arrive; commands submitted from any thread are
+ * copied into a fixed ring and sent from the reactor thread when the
+ * eventfd wakes it.  The library's cancel eventfd is in the set too.
+ * Nothing polls and nothing is allocated while running.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+#include <sys/types.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "rdpc101.h"
+#include "librdpc101-priv.h"
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_EVENTFD_H) \
+	&& defined(HAVE_LINUX_HIDRAW_H)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define REACTOR_CMDS	64
+#define REACTOR_EVENTS	16
+
+static char reactor_cancel_tag;	/* epoll data of the cancel fd */
+
+struct reactor_cmd {
+	struct rdpc101_dev *rp;
+	unsigned char report[RDPC101_REPORT_SIZE];
+};
+
+struct rdpc101_reactor {
+	int epfd;
+	int evfd;
+	volatile sig_atomic_t stop;
+	rdpc101_status_cb cb;
+	void *arg;
+	pthread_mutex_t lock;
+	unsigned head, tail;
+	struct reactor_cmd cmds[REACTOR_CMDS];
+};
+
+struct rdpc101_reactor *
+rdpc101_reactor_new(rdpc101_status_cb cb, void *arg)
+{
+	struct rdpc101_reactor *r;
+	struct epoll_event ev;
+
+	if ((r = calloc(1, sizeof *r)) == NULL)
+		return NULL;
+	r->cb = cb;
+	r->arg = arg;
+	pthread_mutex_init(&r->lock, NULL);
+	r->epfd = epoll_create1(EPOLL_CLOEXEC);
+	r->evfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (r->epfd < 0 || r->evfd < 0)
+		goto fail;
+	memset(&ev, 0, sizeof ev);
+	ev.events = EPOLLIN;
+	ev.data.ptr = r;
+	if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->evfd, &ev) < 0)
+		goto fail;
+	ev.data.ptr = &reactor_cancel_tag;
+	if (rdpc101_cancel_fd() < 0
+			|| epoll_ctl(r->epfd, EPOLL_CTL_ADD, rdpc101_cancel_fd(), &ev) < 0)
+		goto fail;
+	return r;
+fail:
+	rdpc101_reactor_free(r);
+	return NULL;
+}
+
+void rdpc101_reactor_free(struct rdpc101_reactor *r)
+{
+	if (!r)
+		return;
+	if (r->evfd >= 0)
+		close(r->evfd);
+	if (r->epfd >= 0)
+		close(r->epfd);
+	pthread_mutex_destroy(&r->lock);
+	free(r);
+}
+
+/*
+ * The device must be opened with the hidraw backend.
+ */
+int rdpc101_reactor_add(struct rdpc101_reactor *r, struct rdpc101_dev *rp)
+{
+	struct epoll_event ev;
+	int fd;
+
+	if ((fd = rdpc101_fileno(rp)) < 0)
+		return -1;
+	memset(&ev, 0, sizeof ev);
+	ev.events = EPOLLIN;
+	ev.data.ptr = rp;
+	return epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static void reactor_wake(struct rdpc101_reactor *r)
+{
+	uint64_t one = 1;
+	ssize_t n;
+
+	n = write(r->evfd, &one, sizeof one);
+	(void) n;
+}
+
+/*
+ * Queue a command for rp; safe from any thread.  Fails when the ring
+ * is full.
+ */
+int rdpc101_reactor_submit(struct rdpc101_reactor *r, struct rdpc101_dev *rp,
+		enum rdpc_cmd cmd, int value)
+{
+	struct reactor_cmd *c;
+
+	pthread_mutex_lock(&r->lock);
+	if (r->tail - r->head >= REACTOR_CMDS)
+	{
+		pthread_mutex_unlock(&r->lock);
+		return -1;
+	}
+	c = &r->cmds[r->tail++ % REACTOR_CMDS];
+	c->rp = rp;
+	rdpc101_build_report(c->report, cmd, value);
+	pthread_mutex_unlock(&r->lock);
+	reactor_wake(r);
+	return 0;
+}
+
+/*
+ * Make rdpc101_reactor_run() return; async-signal-safe.
+ */
+void rdpc101_reactor_stop(struct rdpc101_reactor *r)
+{
+	r->stop = TRUE;
+	reactor_wake(r);
+}
+
+static void reactor_drain_cmds(struct rdpc101_reactor *r)
+{
+	uint64_t count;
+	ssize_t n;
+
+	n = read(r->evfd, &count, sizeof count);
+	(void) n;
+	pthread_mutex_lock(&r->lock);
+	while (r->head != r->tail)
+	{
+		struct reactor_cmd c = r->cmds[r->head++ % REACTOR_CMDS];
+
+		pthread_mutex_unlock(&r->lock);
+		rdpc101_set_report(c.rp, c.report, sizeof c.report);
+		pthread_mutex_lock(&r->lock);
+	}
+	pthread_mutex_unlock(&r->lock);
+}
+
+static int reactor_read_dev(struct rdpc101_reactor *r, struct rdpc101_dev *rp)
+{
+	int n;
+
+	while ((n = rdpc101_hidraw_read(rp, rp->rbuf, sizeof rp->rbuf, 0)) > 0)
+	{
+		rp->rlen = n;
+		if (rdpc101_decode_state(rp, rp->rbuf, n) > 0 && r->cb)
+			r->cb(rp, r->arg);
+	}
+	return n;
+}
+
+/*
+ * Serve events until rdpc101_reactor_stop() or, if timeout_ms >= 0,
+ * until that much time has passed.  A stop requested while the reactor
+ * is not running makes the next call return at once.
+ */
+int rdpc101_reactor_run(struct rdpc101_reactor *r, int timeout_ms)
+{
+	struct epoll_event events[REACTOR_EVENTS];
+	uint64_t deadline = rdpc101_now_us() + (uint64_t) timeout_ms * 1000;
+
+	for (;;)
+	{
+		int wait = -1;
+		int n, i;
+
+		if (rdpc101_cancelled())
+		{
+			errno = ECANCELED;
+			return -1;
+		}
+		if (r->stop)
+		{
+			r->stop = FALSE;
+			break;
+		}
+		if (timeout_ms >= 0)
+		{
+			uint64_t now = rdpc101_now_us();
+
+			if (now >= deadline)
+				break;
+			wait = (deadline - now + 999) / 1000;
+		}
+		if ((n = epoll_wait(r->epfd, events, REACTOR_EVENTS, wait)) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		for (i = 0; i < n; i++)
+		{
+			struct rdpc101_dev *rp;
+
+			if (events[i].data.ptr == r)
+			{
+				reactor_drain_cmds(r);
+				continue;
+			}
+			if (events[i].data.ptr == &reactor_cancel_tag)
+			{
+				/* left over from a cancel that was reset */
+				if (!rdpc101_cancelled())
+					rdpc101_cancel_drain();
+				continue;
+			}
+			rp = events[i].data.ptr;
+			if ((events[i].events & (EPOLLERR | EPOLLHUP))
+					|| reactor_read_dev(r, rp) < 0)
+				epoll_ctl(r->epfd, EPOLL_CTL_DEL, rp->fd, NULL);
+		}
+	}
+	return 0;
+}
+
+#else
+
+struct rdpc101_reactor *
+rdpc101_reactor_new(rdpc101_status_cb cb, void *arg)
+{
+	return NULL;
+}
+
+void rdpc101_reactor_free(struct rdpc101_reactor *r)
+{
+}
+
+int rdpc101_reactor_add(struct rdpc101_reactor *r, struct rdpc101_dev *rp)
+{
+	return -1;
+}
+
+int rdpc101_reactor_submit(struct rdpc101_reactor *r, struct rdpc101_dev *rp,
+		enum rdpc_cmd cmd, int value)
+{
+	return -1;
+}
+
+void rdpc101_reactor_stop(struct rdpc101_reactor *r)
+{
+}
+
+int rdpc101_reactor_run(struct rdpc101_reactor *r, int timeout_ms)
+{
+	return -1;
+}
+
+#endif
+
+/*-
+ * Copyright (c) 2009 NISHIO Yasuhiro <nishio@hh.iij4u.or.jp>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
@@ -0,0 +1,165 @@
+/*
+ * Flight recorder for SUNTAC RDPC101.
+ *
+ * Every feature report sent and every input report read is appended to
+ * a fixed-size ring in a shared file mapping, with a timestamp, the
+ * device index and the result.  Writers claim a slot with one atomic
+ * add and publish it by storing its sequence number last, so there is
+ * no lock and no system call on the hot path.  The pages belong to the
+ * file, so the ring outlives a crash of the process; rdpc-recdump
+ * decodes it.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "rdpc101.h"
+#include "librdpc101-priv.h"
+
+struct rdpc101_rec_header *rdpc101_rec;
+static struct rdpc101_rec_slot *rec_slots;
+static size_t rec_len;
+
+/*
+ * Map path as the recorder ring, creating it with nslots slots.  An
+ * existing ring of the same geometry is appended to; any other file is
+ * left alone, since it may hold the only trace of a crash.
+ */
+int rdpc101_recorder_open(const char *path, unsigned nslots)
+{
+	struct rdpc101_rec_header *h;
+	struct stat st;
+	size_t len;
+	int fd;
+
+	if (rdpc101_rec || nslots == 0)
+		return -1;
+	len = sizeof *h + (size_t) nslots * sizeof *rec_slots;
+	if ((fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0)
+	{
+		perror(path);
+		return -1;
+	}
+	if (fstat(fd, &st) < 0 || (st.st_size == 0 && ftruncate(fd, len) < 0))
+	{
+		perror(path);
+		close(fd);
+		return -1;
+	}
+	if (st.st_size != 0 && st.st_size != len)
+	{
+		fprintf(stderr, "%s: not a recorder ring of %u slots,"
+				" move it away first\n", path, nslots);
+		close(fd);
+		return -1;
+	}
+	h = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (h == MAP_FAILED)
+	{
+		perror(path);
+		return -1;
+	}
+	if (st.st_size == 0)
+	{
+		h->slot_size = sizeof *rec_slots;
+		h->nslots = nslots;
+		atomic_init(&h->next, 0);
+		memcpy(h->magic, RDPC101_REC_MAGIC, sizeof h->magic);
+	}
+	else if (memcmp(h->magic, RDPC101_REC_MAGIC, sizeof h->magic) != 0
+			|| h->slot_size != sizeof *rec_slots || h->nslots != nslots)
+	{
+		fprintf(stderr, "%s: not a recorder ring of %u slots,"
+				" move it away first\n", path, nslots);
+		munmap(h, len);
+		return -1;
+	}
+	rec_slots = (struct rdpc101_rec_slot *) (h + 1);
+	rec_len = len;
+	rdpc101_rec = h;
+	return 0;
+}
+
+/*
+ * Stop recording.  Only call once no other thread can be sending or
+ * reading reports.
+ */
+void rdpc101_recorder_close(void)
+{
+	struct rdpc101_rec_header *h = rdpc101_rec;
+
+	if (!h)
+		return;
+	rdpc101_rec = NULL;
+	munmap(h, rec_len);
+	rec_slots = NULL;
+}
+
+void rdpc101_record_slow(struct rdpc101_dev *rp, enum rdpc101_rec_kind kind,
+		const unsigned char *data, int size, int result)
+{
+	struct rdpc101_rec_header *h = rdpc101_rec;
+	struct rdpc101_rec_slot *s;
+	struct timespec t;
+	uint64_t n;
+
+	n = atomic_fetch_add_explicit(&h->next, 1, memory_order_relaxed);
+	s = &rec_slots[n % h->nslots];
+	atomic_store_explicit(&s->seq, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	clock_gettime(CLOCK_REALTIME, &t);
+	s->t_ns = (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+	s->dev = rp ? rp->index : -1;
+	s->result = result;
+	s->kind = kind;
+	s->size = size < 0 ? 0 : size > 255 ? 255 : size;
+	if (size > RDPC101_REC_DATA)
+		size = RDPC101_REC_DATA;
+	if (size > 0)
+		memcpy(s->data, data, size);
+
+	atomic_store_explicit(&s->seq, n + 1, memory_order_release);
+}
+
+/*-
+ * Copyright (c) 2009 NISHIO Yasuhiro <nishio@hh.iij4u.or.jp>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
@@ -0,0 +1,215 @@
+/*
+ * Real-time mode for SUNTAC RDPC101.
+ *
+ * rdpc101_rt_start() locks the process memory, prefaults the stack and
+ * moves the calling thread to the chosen CPUs at SCHED_FIFO priority;
+ * command queue workers started afterwards apply the same settings to
+ * themselves.  rdpc101_rt_poll() reads status reports on an absolute
+ * clock_nanosleep() period and keeps a histogram of how late each
+ * wakeup was.  Reports land in rp->rbuf and the jitter record belongs
+ * to the caller, so the loop neither allocates nor faults.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+#if defined(HAVE_SCHED_SETAFFINITY)
+#define _GNU_SOURCE
+#endif
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include "rdpc101.h"
+
+#define RT_PREFAULT_STACK	(256 * 1024)
+
+static struct rdpc101_rt rt_conf;
+static int rt_enabled;
+
+static void rt_prefault_stack(void)
+{
+	volatile unsigned char buf[RT_PREFAULT_STACK];
+	size_t i;
+
+	for (i = 0; i < sizeof buf; i += 4096)
+		buf[i] = 0;
+}
+
+/*
+ * Apply the rdpc101_rt_start() settings to the calling thread; a no-op
+ * unless real-time mode was started.
+ */
+int rdpc101_rt_thread(void)
+{
+	struct sched_param sp;
+	int ret = 0;
+
+	if (!rt_enabled)
+		return 0;
+#if defined(HAVE_SCHED_SETAFFINITY)
+	if (rt_conf.cpus)
+	{
+		cpu_set_t set;
+		unsigned i;
+
+		CPU_ZERO(&set);
+		for (i = 0; i < sizeof rt_conf.cpus * 8; i++)
+			if (rt_conf.cpus & (1UL << i))
+				CPU_SET(i, &set);
+		if (sched_setaffinity(0, sizeof set, &set) < 0)
+			ret = -1;
+	}
+#endif
+	if (rt_conf.priority > 0)
+	{
+		memset(&sp, 0, sizeof sp);
+		sp.sched_priority = rt_conf.priority;
+		if ((errno = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp))
+				!= 0)
+			ret = -1;
+	}
+	if (rt_conf.lock_memory)
+		rt_prefault_stack();
+	return ret;
+}
+
+/*
+ * Enter real-time mode.  Needs CAP_SYS_NICE for the priority and
+ * CAP_IPC_LOCK or a large RLIMIT_MEMLOCK for the memory lock; returns
+ * -1 with errno set when any part could not be applied, leaving the
+ * parts that could in effect.
+ */
+int rdpc101_rt_start(const struct rdpc101_rt *rt)
+{
+	int ret = 0;
+
+	rt_conf = *rt;
+	rt_enabled = TRUE;
+#if defined(HAVE_MLOCKALL)
+	if (rt->lock_memory && mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+		ret = -1;
+#endif
+	if (rdpc101_rt_thread() < 0)
+		ret = -1;
+	return ret;
+}
+
+static void rt_jitter_add(struct rdpc101_jitter *j, long late_us)
+{
+	int bin = 0;
+
+	while (bin < RDPC101_JITTER_BINS - 1 && (1L << bin) <= late_us)
+		bin++;
+	j->hist[bin]++;
+	j->wakeups++;
+	j->sum_us += late_us;
+	if (late_us > j->max_us)
+		j->max_us = late_us;
+}
+
+static void rt_add_ns(struct timespec *t, long ns)
+{
+	t->tv_nsec += ns % 1000000000;
+	t->tv_sec += ns / 1000000000;
+	if (t->tv_nsec >= 1000000000)
+	{
+		t->tv_nsec -= 1000000000;
+		t->tv_sec++;
+	}
+}
+
+/*
+ * Every period_us, read the status reports queued since the last
+ * wakeup and hand each to cb.  Runs count periods, or until an error
+ * if count is 0.  A wakeup later than a whole period skips the missed
+ * periods rather than bursting to catch up.  The period continues from
+ * j->next_ns, so successive calls with the same record keep one
+ * schedule; zero the record to start afresh.
+ */
+int rdpc101_rt_poll(struct rdpc101_dev *rp, long period_us, long count,
+		rdpc101_status_cb cb, void *arg, struct rdpc101_jitter *j)
+{
+	struct timespec next, now;
+	long n;
+	int ret;
+
+	if (period_us <= 0 || rdpc101_open(rp) < 0)
+		return -1;
+	if (j->next_ns == 0)
+		clock_gettime(CLOCK_MONOTONIC, &next);
+	else
+	{
+		next.tv_sec = j->next_ns / 1000000000;
+		next.tv_nsec = j->next_ns % 1000000000;
+	}
+	for (n = 0; count == 0 || n < count; n++)
+	{
+		long late_us;
+
+		rt_add_ns(&next, period_us * 1000);
+		while ((ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next,
+				NULL)) == EINTR && !rdpc101_cancelled())
+			;
+		if (ret == EINTR)
+			ret = ECANCELED;
+		if (ret != 0)
+		{
+			errno = ret;
+			return -1;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		late_us = (now.tv_sec - next.tv_sec) * 1000000
+				+ (now.tv_nsec - next.tv_nsec) / 1000;
+		rt_jitter_add(j, late_us);
+		if (late_us >= period_us)
+		{
+			j->overruns += late_us / period_us;
+			rt_add_ns(&next, late_us / period_us * period_us * 1000);
+		}
+		j->next_ns = (uint64_t) next.tv_sec * 1000000000 + next.tv_nsec;
+
+		while ((ret = rdpc101_read_state(rp, 0)) > 0)
+			if (cb)
+				cb(rp, arg);
+		if (ret < 0)
+			return ret;
+	}
+	return 0;
+}
+
+/*-
+ * Copyright (c) 2009 NISHIO Yasuhiro <nishio@hh.iij4u.or.jp>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
@@ -0,0 +1,172 @@
+/*
+ * Seek scan session for SUNTAC RDPC101.
+ *
+ * Mutes once, keeps SIGTSTP blocked in the calling thread for the whole
+ * scan and seeks up through the range, handing every status report to
+ * the callback.  The original band, frequency and mute state are
+ * restored once at the end, also when a report fails or the scan is
+ * cancelled with rdpc101_cancel(); every wait is a cancellation point.
+ */
+
+#include <sys/types.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include "rdpc101.h"
+
+#define SCAN_SEEK_TIMEOUT_US	(10 * 1000000)
+#define SCAN_READ_MS		200
+
+static void scan_sigset(sigset_t *set)
+{
+	sigemptyset(set);
+	sigaddset(set, SIGTSTP);
+}
+
+/*
+ * Seek up once and wait until the tuner stops.  Returns 1 when it
+ * stopped, <0 on error or cancellation.
+ */
+static int scan_seek_one(struct rdpc101_dev *rp, rdpc101_scan_cb cb,
+		void *arg)
+{
+	uint64_t t0 = rdpc101_now_us();
+	int seen_seeking = FALSE;
+	int ret;
+
+	if ((ret = rdpc101_seek(rp, RDPC_SEEK_UP)) < 0)
+		return ret;
+	for (;;)
+	{
+		uint64_t elapsed;
+
+		if ((ret = rdpc101_read_state(rp, SCAN_READ_MS)) < 0)
+			return ret;
+		elapsed = rdpc101_now_us() - t0;
+		if (ret == 0)
+		{
+			if (elapsed > SCAN_SEEK_TIMEOUT_US)
+			{
+				errno = ETIMEDOUT;
+				return -1;
+			}
+			continue;
+		}
+		if (rp->cur.ma & RDPC_MA_SEEKING_MASK)
+		{
+			seen_seeking = TRUE;
+			if (cb && cb(rp, RDPC101_SCAN_SEEKING, arg))
+				return 0;
+		}
+		else if (seen_seeking || elapsed >= RDPC101_SEEK_SETTLE_US)
+			return 1;
+	}
+}
+
+/*
+ * Seek through [freq_min, freq_max] of one band.  cb sees every report
+ * while seeking and every station found; a non-zero return ends the
+ * scan early.  Returns the number of stations found, or -1 (errno is
+ * ECANCELED if cancelled).
+ */
+int rdpc101_scan_range(struct rdpc101_dev *rp, int freq_min, int freq_max,
+		rdpc101_scan_cb cb, void *arg)
+{
+	enum rdpc_band band = rdpc101_band(freq_min);
+	enum rdpc_band oband;
+	enum rdpc_mute omute = rp->mute;
+	sigset_t set, oset;
+	int ofreq, found = 0;
+	int ret, err = 0;
+
+	if (band == RDPC_BAND_ERROR || rdpc101_band(freq_max) != band)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if (rp->cur.ma == RDPC_MA_UNSPEC && rdpc101_update_state(rp) < 0)
+		return -1;
+	ofreq = rp->cur.freq;
+	oband = rdpc101_band(ofreq);
+
+	scan_sigset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, &oset);
+	if ((ret = rdpc101_mute(rp, RDPC_MUTE_ON)) < 0)
+		goto restore;
+	if (oband != band && (ret = rdpc101_set_band(rp, band)) < 0)
+		goto restore;
+	/* also proves the band switch took */
+	if ((ret = rdpc101_tune_sample(rp, freq_min, RDPC101_TIMEOUT)) < 0)
+		goto restore;
+
+	while (rp->cur.freq < freq_max)
+	{
+		int last = rp->cur.freq;
+
+		if ((ret = scan_seek_one(rp, cb, arg)) <= 0)
+			break;
+		/* wrapped around or stuck: nothing more above */
+		if (rp->cur.freq <= last || rp->cur.freq > freq_max)
+			break;
+		found++;
+		if (cb && cb(rp, RDPC101_SCAN_FOUND, arg))
+			break;
+	}
+
+restore:
+	if (ret < 0)
+		err = errno;
+	/* nothing to go back to if the state was never read */
+	if (oband >= 0 && ofreq > 0)
+	{
+		if (oband != band && rdpc101_set_band(rp, oband) < 0)
+			ret = -1;
+		if (rdpc101_set_freq(rp, ofreq) < 0)
+			ret = -1;
+	}
+	if (rdpc101_mute(rp, omute) < 0)
+		ret = -1;
+	pthread_sigmask(SIG_SETMASK, &oset, NULL);
+	if (ret < 0)
+	{
+		if (err)
+			errno = err;
+		return -1;
+	}
+	return found;
+}
+
+/*-
+ * Copyright (c) 2009 NISHIO Yasuhiro <nishio@hh.iij4u.or.jp>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
@@ -6,10 +6,23 @@
  * http://www.signal11.us/oss/hidapi/
  */
 
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+#if defined(HAVE_SYS_EVENTFD_H)
+#include <sys/eventfd.h>
+#endif
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include "rdpc101.h"
+#include "librdpc101-priv.h"
 #include <hidapi.h>
 
 __RCSID("$Id: librdpc101.c,v 1.3 2009/07/07 13:33:53 nishio Exp $");
@@ -26,6 +39,14 @@ static struct radio_freq_desc rfd[] =
 
 #define NRFDS	(sizeof (rfd) / sizeof (struct radio_freq_desc))
 
+static enum rdpc101_backend default_backend = RDPC101_BACKEND_HIDAPI;
+
+static struct {
+	rdpc101_status_cb cb;
+	void *arg;
+} state_hooks[RDPC101_STATE_HOOKS];
+static int nstate_hooks;
+
 int error_hidapi(const char *label, hid_device* device)
 {
 	fprintf(stderr, "%s: %s\n", label, hid_error(device));
@@ -41,14 +62,16 @@ void rdpc101_cleanup(struct dev_info *dev_info)
 	{
 		struct rdpc101_dev *pp;
 
-		if (cp->handle)
-		{
-			hid_close(cp->handle);
-		}
+		rdpc101_queue_stop(cp);
+		rdpc101_log_flush(cp);
+		rdpc101_close(cp);
 		pp = cp;
 		cp = cp->next;
 		free(pp);
 	}
+	rdpc101_log_stop();
+	rdpc101_archive_close();
+	rdpc101_recorder_close();
 	hid_free_enumeration(dev_info->devs);
 	hid_exit();
 }
@@ -113,6 +136,24 @@ rdpc101_device(struct rdpc101_dev *rp, int index)
 	return NULL ;
 }
 
+struct rdpc101_dev *
+rdpc101_device_by_serial(struct rdpc101_dev *rp, const char *serial)
+{
+	struct rdpc101_dev *p;
+	char buf[RDPC101_SERIAL_MAX];
+
+	for (p = rp; p; p = p->next)
+	{
+		if (!p->dev->serial_number
+				|| wcstombs(buf, p->dev->serial_number, sizeof buf) == (size_t) -1)
+			continue;
+		buf[sizeof buf - 1] = '\0';
+		if (strcmp(buf, serial) == 0)
+			return p;
+	}
+	return NULL ;
+}
+
 static struct rdpc101_dev *
 rdpc101_new_node(void)
 {
@@ -123,11 +164,21 @@ rdpc101_new_node(void)
 		return NULL ;
 	}
 	p->next = NULL;
+	p->index = 0;
 	p->dev = NULL;
 	p->handle = NULL;
+	p->backend = default_backend;
+	p->fd = -1;
+	p->rlen = 0;
+	p->cmdq = NULL;
+	memset(&p->log, 0, sizeof p->log);
 	p->cur.ma = RDPC_MA_UNSPEC;
 	p->cur.sig_intensity = 0;
 	p->cur.freq = 0;
+	p->prev.ma = RDPC_MA_UNSPEC;
+	p->prev.sig_intensity = -1;
+	p->prev.freq = 0;
+	p->mute = RDPC_MUTE_OFF;
 	return p;
 }
 
@@ -139,7 +190,9 @@ rdpc101_append_node(struct rdpc101_dev *cur, struct hid_device_info* dev)
 	{
 		return NULL ;
 	}
-	p = rdpc101_new_node();
+	if ((p = rdpc101_new_node()) == NULL)
+		return NULL ;
+	p->index = cur->dev ? cur->index + 1 : 0;
 	p->dev = dev;
 	cur->next = p;
 	return p;
@@ -151,12 +204,16 @@ rdpc101_get_list(struct dev_info *dip)
 	struct rdpc101_dev head;
 	struct rdpc101_dev *cur = &head;
 	struct hid_device_info* dev;
+	const char *rec;
 
+	if (!rdpc101_rec && (rec = getenv(RDPC101_RECORDER_ENV)) && *rec)
+		rdpc101_recorder_open(rec, RDPC101_RECORDER_SLOTS);
 	dip->devs = hid_enumerate(RDPC101_VENDORID, RDPC101_PRODUCTID);
 	if (dip->devs == NULL)
 		return NULL;
 
 	head.next = NULL;
+	head.dev = NULL;
 
 	for (dev = dip->devs; dev; dev = dev->next)
 	{
@@ -166,54 +223,110 @@ rdpc101_get_list(struct dev_info *dip)
 	return (dip->rp = head.next);
 }
 
-hid_device*
-get_handle(struct rdpc101_dev *rp)
+/*
+ * Backend used by devices opened from now on.
+ */
+int rdpc101_set_backend(enum rdpc101_backend backend)
 {
-	int ret;
+	if (backend == RDPC101_BACKEND_HIDRAW && !rdpc101_hidraw_available())
+		return -1;
+	default_backend = backend;
+	return 0;
+}
 
-	if (rp->handle)
-		return rp->handle;
-	if ((rp->handle = hid_open(RDPC101_VENDORID, RDPC101_PRODUCTID, rp->dev->serial_number)) == NULL)
+int rdpc101_open(struct rdpc101_dev *rp)
+{
+	int ret = 0;
+
+	if (rp->handle || rp->fd >= 0)
+		return 0;
+	rp->backend = default_backend;
+	RDPC101_PROBE2(open_entry, rp->index, rp->backend);
+	if (rp->backend == RDPC101_BACKEND_HIDRAW)
+		ret = rdpc101_hidraw_open(rp);
+	else if ((rp->handle = hid_open(RDPC101_VENDORID, RDPC101_PRODUCTID, rp->dev->serial_number)) == NULL)
 	{
 		error_hidapi("open", rp->handle);
-		return NULL;
+		ret = -1;
 	}
-	return rp->handle;
+	RDPC101_PROBE2(open_return, rp->index, ret);
+	return ret;
 }
 
-static void dump_packet(char *label, unsigned char *p, int size)
+void rdpc101_close(struct rdpc101_dev *rp)
 {
-	fprintf(stderr, "%10s:", label);
-	while (size-- > 0)
-		fprintf(stderr, " %2.2x", *p++);
-	putc('\n', stderr);
+	if (rp->handle)
+	{
+		hid_close(rp->handle);
+		rp->handle = NULL;
+	}
+	if (rp->fd >= 0)
+		rdpc101_hidraw_close(rp);
+}
+
+/*
+ * File descriptor that becomes readable when a status report arrives,
+ * or -1 if the backend has none (hidapi).
+ */
+int rdpc101_fileno(struct rdpc101_dev *rp)
+{
+	if (rdpc101_open(rp) < 0)
+		return -1;
+	return rp->fd;
 }
 
 static int check_all_zero(unsigned char *p, int size)
 {
 	while (size-- > 0)
-	{
 		if (*p++)
-		{
-			fprintf(stderr, "XXX: %2.2x\n", *p);
 			return FALSE;
-		}
-	}
 	return TRUE;
 }
 
-int rdpc101_update_state(struct rdpc101_dev *rp)
+/*
+ * Have cb called after every decoded status report, in the thread that
+ * read it.  Register hooks before any device is read.
+ */
+int rdpc101_add_state_hook(rdpc101_status_cb cb, void *arg)
+{
+	if (nstate_hooks >= RDPC101_STATE_HOOKS)
+		return -1;
+	state_hooks[nstate_hooks].cb = cb;
+	state_hooks[nstate_hooks].arg = arg;
+	nstate_hooks++;
+	return 0;
+}
+
+void rdpc101_del_state_hook(rdpc101_status_cb cb, void *arg)
+{
+	int i;
+
+	for (i = 0; i < nstate_hooks; i++)
+		if (state_hooks[i].cb == cb && state_hooks[i].arg == arg)
+		{
+			memmove(&state_hooks[i], &state_hooks[i + 1],
+					(nstate_hooks - i - 1) * sizeof state_hooks[0]);
+			nstate_hooks--;
+			return;
+		}
+}
+
+/*
+ * Decode a status report into cur.  Unknown packets are logged but
+ * decoded all the same, as before.
+ */
+int rdpc101_decode_state(struct rdpc101_dev *rp, unsigned char *packet,
+		int size)
 {
-	uint8_t packet[1024];
 	int freq, ma, mma;
-	int ret;
+	int valid = TRUE;
+	int i;
 
-    if(get_handle(rp) == NULL) {
-        return -1;
-    }
-    
-	if((ret = hid_read(get_handle(rp), packet, sizeof packet)) < 0) {
-		return ret;
+	if (size < RDPC_STATE_INDEX_MAX)
+	{
+		rdpc101_log_packet(rp, "short pkt", packet, size);
+		rdpc101_record(rp, RDPC101_REC_INPUT, packet, size, -1);
+		return -1;
 	}
 
 	/* check unknown packet */
@@ -221,71 +334,401 @@ int rdpc101_update_state(struct rdpc101_dev *rp)
 			| packet[RDPC_STATE_INDEX_FREQ_LO]);
 	ma = packet[RDPC_STATE_INDEX_MA];
 	mma = ma & ~RDPC_MA_SEEKING_MASK;
-	if (ret != RDPC101_STATE_PACKET_SIZE || packet[0] != 0x12
+	if (size != RDPC101_STATE_PACKET_SIZE || packet[0] != 0x12
 			|| (mma != RDPC_MA_MONO && mma != RDPC_MA_STEREO
 					&& mma != (0x3e & ~RDPC_MA_SEEKING_MASK)&&
 					mma != (0x3f & ~RDPC_MA_SEEKING_MASK) &&
 					mma != (0xa7 & ~RDPC_MA_SEEKING_MASK))||
 					rdpc101_band(freq) == RDPC_BAND_ERROR ||
 					!check_all_zero(&packet[RDPC_STATE_INDEX_MAX],
-							ret - RDPC_STATE_INDEX_MAX))
-					dump_packet("stat pkt", packet, ret);
+							size - RDPC_STATE_INDEX_MAX))
+	{
+		rdpc101_log_packet(rp, "stat pkt", packet, size);
+		valid = FALSE;
+	}
+	if ((rp->cur.ma & RDPC_MA_SEEKING_MASK) && !(ma & RDPC_MA_SEEKING_MASK))
+		RDPC101_PROBE3(seek_done, rp->index, freq,
+				packet[RDPC_STATE_INDEX_SIGINTENSITY]);
 	rp->cur.sig_intensity = packet[RDPC_STATE_INDEX_SIGINTENSITY];
 	rp->cur.freq = freq;
 	rp->cur.ma = ma;
+	RDPC101_PROBE5(state, rp->index, freq, ma, rp->cur.sig_intensity, valid);
+	rdpc101_record(rp, RDPC101_REC_INPUT, packet, size, valid);
+	for (i = 0; i < nstate_hooks; i++)
+		state_hooks[i].cb(rp, state_hooks[i].arg);
+
+	return 1;
+}
+
+/*
+ * Cancellation.  rdpc101_cancel() only sets a flag and writes to an
+ * eventfd, so a signal handler may call it.  Reactors wait on the
+ * eventfd; the other waits in the library wake up at least every
+ * RDPC101_CANCEL_SLICE_MS to look at the flag.  Either fails with
+ * ECANCELED.
+ */
+static volatile sig_atomic_t cancel_flag;
+static int cancel_evfd = -1;
+static pthread_once_t cancel_once = PTHREAD_ONCE_INIT;
+
+static void cancel_evfd_init(void)
+{
+#if defined(HAVE_SYS_EVENTFD_H)
+	cancel_evfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+#endif
+}
+
+/*
+ * An fd that is readable once rdpc101_cancel() has been called, or -1.
+ * It is never closed.
+ */
+int rdpc101_cancel_fd(void)
+{
+	pthread_once(&cancel_once, cancel_evfd_init);
+	return cancel_evfd;
+}
+
+void rdpc101_cancel(void)
+{
+	cancel_flag = TRUE;
+	if (cancel_evfd >= 0)
+	{
+		uint64_t one = 1;
+		ssize_t n;
+
+		n = write(cancel_evfd, &one, sizeof one);
+		(void) n;
+	}
+}
+
+int rdpc101_cancelled(void)
+{
+	return cancel_flag;
+}
+
+void rdpc101_cancel_reset(void)
+{
+	cancel_flag = FALSE;
+	rdpc101_cancel_drain();
+}
+
+/* clear the cancel fd; readers call it when they find no cancel pending */
+void rdpc101_cancel_drain(void)
+{
+	if (cancel_evfd >= 0)
+	{
+		uint64_t count;
+		ssize_t n;
 
+		n = read(cancel_evfd, &count, sizeof count);
+		(void) n;
+	}
+}
+
+/*
+ * Read one status report, waiting at most timeout_ms (-1 blocks).
+ * Returns 1 when cur was updated, 0 on timeout, <0 on error (errno is
+ * ECANCELED after rdpc101_cancel()).
+ */
+int rdpc101_read_state(struct rdpc101_dev *rp, int timeout_ms)
+{
+	uint64_t deadline = rdpc101_now_us() + (uint64_t) timeout_ms * 1000;
+	int ret;
+
+	if (rdpc101_open(rp) < 0)
+		return -1;
+	RDPC101_PROBE2(read_entry, rp->index, timeout_ms);
+	for (;;)
+	{
+		int wait = RDPC101_CANCEL_SLICE_MS;
+
+		if (cancel_flag)
+		{
+			errno = ECANCELED;
+			ret = -1;
+			break;
+		}
+		if (timeout_ms >= 0)
+		{
+			uint64_t now = rdpc101_now_us();
+			uint64_t left = now < deadline ? (deadline - now + 999) / 1000 : 0;
+
+			if (left < wait)
+				wait = left;
+		}
+		if (rp->fd >= 0)
+			ret = rdpc101_hidraw_read(rp, rp->rbuf, sizeof rp->rbuf, wait);
+		else
+			ret = hid_read_timeout(rp->handle, rp->rbuf, sizeof rp->rbuf, wait);
+		if (ret > 0)
+		{
+			rp->rlen = ret;
+			ret = rdpc101_decode_state(rp, rp->rbuf, ret);
+		}
+		else if (ret < 0)
+			rdpc101_record(rp, RDPC101_REC_INPUT, NULL, 0, ret);
+		if (ret != 0 || wait < RDPC101_CANCEL_SLICE_MS)
+			break;
+	}
+	RDPC101_PROBE2(read_return, rp->index, ret);
+	return ret;
+}
+
+int rdpc101_update_state(struct rdpc101_dev *rp)
+{
+	int ret;
+
+	if ((ret = rdpc101_read_state(rp, -1)) < 0)
+		return ret;
 	return 0;
 }
 
+/*
+ * Which fields differ between two states.  sig_intensity only counts
+ * when it moved by more than deadband.
+ */
+unsigned rdpc101_state_diff(const struct rdpc_state *a,
+		const struct rdpc_state *b, int deadband)
+{
+	unsigned changes = 0;
+
+	if (a->freq != b->freq)
+		changes |= RDPC101_CHANGE_FREQ;
+	if ((a->ma & ~RDPC_MA_SEEKING_MASK) != (b->ma & ~RDPC_MA_SEEKING_MASK))
+		changes |= RDPC101_CHANGE_STEREO;
+	if ((a->ma & RDPC_MA_SEEKING_MASK) != (b->ma & RDPC_MA_SEEKING_MASK))
+		changes |= RDPC101_CHANGE_SEEKING;
+	if (abs(a->sig_intensity - b->sig_intensity) > deadband)
+		changes |= RDPC101_CHANGE_SIGNAL;
+	return changes;
+}
+
+/*
+ * Compare cur against the last reported state in prev; on a change,
+ * cur becomes the new prev.  The first call after open always reports
+ * every field.
+ */
+unsigned rdpc101_state_changed(struct rdpc101_dev *rp, int deadband)
+{
+	unsigned changes;
+
+	if (rp->prev.sig_intensity < 0)
+		changes = RDPC101_CHANGE_ALL;
+	else
+		changes = rdpc101_state_diff(&rp->prev, &rp->cur, deadband);
+	if (changes)
+		rp->prev = rp->cur;
+	return changes;
+}
+
+/*
+ * Read status reports until one differs from prev.
+ * Returns the change mask, 0 on timeout, <0 on error.
+ */
+int rdpc101_watch(struct rdpc101_dev *rp, int deadband, int timeout_ms)
+{
+	uint64_t deadline = rdpc101_now_us() + (uint64_t) timeout_ms * 1000;
+	int ret;
+
+	for (;;)
+	{
+		int wait = -1;
+
+		if (timeout_ms >= 0)
+		{
+			uint64_t now = rdpc101_now_us();
+
+			if (now >= deadline)
+				return 0;
+			wait = (deadline - now + 999) / 1000;
+		}
+		if ((ret = rdpc101_read_state(rp, wait)) < 0)
+			return ret;
+		if (ret > 0 && (ret = rdpc101_state_changed(rp, deadband)) != 0)
+			return ret;
+	}
+}
+
 int rdpc101_set_report(struct rdpc101_dev *rp, unsigned char *data,
 		int data_size)
 {
 	int ret;
 
-	if((ret = hid_send_feature_report(get_handle(rp), data, data_size)) < 0) {
-		dump_packet("control_transfer", data, data_size);
+	if (rdpc101_open(rp) < 0)
+		return -1;
+	RDPC101_PROBE3(set_report_entry, rp->index, data[0], data_size);
+	if (rp->fd >= 0)
+		ret = rdpc101_hidraw_send_feature(rp, data, data_size);
+	else
+		ret = hid_send_feature_report(rp->handle, data, data_size);
+	RDPC101_PROBE3(set_report_return, rp->index, data[0], ret);
+	rdpc101_record(rp, RDPC101_REC_FEATURE, data, data_size, ret);
+	if (ret < 0) {
+		rdpc101_log_packet(rp, "control_transfer", data, data_size);
 		return ret;
 	}
 	return ret;
 }
 
+/*
+ * Fill a RDPC101_REPORT_SIZE byte feature report for cmd, so callers
+ * that need exact timing can build it ahead of time.
+ */
+void rdpc101_build_report(unsigned char *packet, enum rdpc_cmd cmd, int value)
+{
+	packet[0] = cmd;
+	switch (cmd)
+	{
+	case RDPC_SETFREQ:
+		packet[1] = value >> 8;
+		packet[2] = value & 0xff;
+		break;
+	case RDPC_BAND:
+		packet[1] = value;
+		packet[2] = 0x02;
+		break;
+	default:
+		packet[1] = value;
+		packet[2] = 0x00;
+		break;
+	}
+}
+
 int rdpc101_set_ma(struct rdpc101_dev *rp, enum rdpc_ma ma)
 {
-	unsigned char packet[3] =
-	{ RDPC_MA, ma, 0x00 };
+	unsigned char packet[RDPC101_REPORT_SIZE];
 
+	rdpc101_build_report(packet, RDPC_MA, ma);
 	return rdpc101_set_report(rp, packet, sizeof packet);
 }
 
 int rdpc101_mute(struct rdpc101_dev *rp, enum rdpc_mute mute)
 {
-	unsigned char packet[3] =
-	{ 0x05, mute, 0x00 };
+	unsigned char packet[RDPC101_REPORT_SIZE];
+	int ret;
 
-	return rdpc101_set_report(rp, packet, sizeof packet);
+	rdpc101_build_report(packet, RDPC_MUTE, mute);
+	if ((ret = rdpc101_set_report(rp, packet, sizeof packet)) >= 0)
+		rp->mute = mute;
+	return ret;
 }
 
 int rdpc101_set_band(struct rdpc101_dev *rp, enum rdpc_band band)
 {
-	unsigned char packet[3] =
-	{ RDPC_BAND, band, 0x02 };
+	unsigned char packet[RDPC101_REPORT_SIZE];
 
+	rdpc101_build_report(packet, RDPC_BAND, band);
 	return rdpc101_set_report(rp, packet, sizeof packet);
 }
 
 int rdpc101_set_freq(struct rdpc101_dev *rp, int freq)
 {
-	unsigned char packet[3] =
-	{ RDPC_SETFREQ, freq >> 8, freq & 0xff };
+	unsigned char packet[RDPC101_REPORT_SIZE];
 
+	rdpc101_build_report(packet, RDPC_SETFREQ, freq);
 	return rdpc101_set_report(rp, packet, sizeof packet);
 }
 
+/*
+ * Tune to freq and wait until the status report shows it, then take
+ * one more report so sig_intensity reflects the new channel.
+ */
+int rdpc101_tune_sample(struct rdpc101_dev *rp, int freq, int timeout_ms)
+{
+	int ret;
+	int tries;
+
+	if ((ret = rdpc101_set_freq(rp, freq)) < 0)
+		return ret;
+	for (tries = 0; tries < RDPC101_TUNE_TRIES; tries++)
+	{
+		if ((ret = rdpc101_read_state(rp, timeout_ms)) < 0)
+			return ret;
+		if (ret > 0 && rp->cur.freq == freq)
+			break;
+	}
+	if (tries == RDPC101_TUNE_TRIES)
+		return -1;
+	if ((ret = rdpc101_read_state(rp, timeout_ms)) < 0)
+		return ret;
+	return rp->cur.sig_intensity;
+}
+
+uint64_t rdpc101_now_us(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t) t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+/*
+ * Tune to freq and return as soon as the tuner has settled: a status
+ * report shows freq and the last RDPC101_SETTLE_REPORTS sig_intensity
+ * values lie within tolerance of each other.  Times are measured from
+ * just before the feature report is sent.
+ * Returns 0 when settled, 1 on timeout, <0 on error.
+ */
+int rdpc101_tune_settle(struct rdpc101_dev *rp, int freq, int tolerance,
+		int timeout_ms, struct rdpc101_settle *res)
+{
+	int window[RDPC101_SETTLE_REPORTS];
+	int nwin = 0;
+	uint64_t t0, now, deadline;
+	int ret;
+
+	res->lock_us = -1;
+	res->settle_us = -1;
+	res->reports = 0;
+	res->sig_intensity = -1;
+
+	t0 = rdpc101_now_us();
+	deadline = t0 + (uint64_t) timeout_ms * 1000;
+	if ((ret = rdpc101_set_freq(rp, freq)) < 0)
+		return ret;
+	while ((now = rdpc101_now_us()) < deadline)
+	{
+		int lo, hi, i;
+
+		if ((ret = rdpc101_read_state(rp, (deadline - now + 999) / 1000)) < 0)
+			return ret;
+		if (ret == 0)
+			break;
+		res->reports++;
+		if (rp->cur.freq != freq || (rp->cur.ma & RDPC_MA_SEEKING_MASK))
+		{
+			nwin = 0;
+			continue;
+		}
+		if (res->lock_us < 0)
+			res->lock_us = rdpc101_now_us() - t0;
+		window[nwin++ % RDPC101_SETTLE_REPORTS] = rp->cur.sig_intensity;
+		if (nwin < RDPC101_SETTLE_REPORTS)
+			continue;
+		lo = hi = window[0];
+		for (i = 1; i < RDPC101_SETTLE_REPORTS; i++)
+		{
+			if (window[i] < lo)
+				lo = window[i];
+			if (window[i] > hi)
+				hi = window[i];
+		}
+		if (hi - lo <= tolerance)
+		{
+			res->settle_us = rdpc101_now_us() - t0;
+			res->sig_intensity = rp->cur.sig_intensity;
+			return 0;
+		}
+	}
+	return 1;
+}
+
 int rdpc101_seek(struct rdpc101_dev *rp, enum rdpc_seek seek_dir)
 {
-	unsigned char packet[3] =
-	{ RDPC_SEEK, seek_dir, 0x00 };
+	unsigned char packet[RDPC101_REPORT_SIZE];
 
+	rdpc101_build_report(packet, RDPC_SEEK, seek_dir);
+	RDPC101_PROBE3(seek_start, rp->index, seek_dir, rp->cur.freq);
 	return rdpc101_set_report(rp, packet, sizeof packet);
 }
 
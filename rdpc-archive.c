@@ -0,0 +1,540 @@
+/*
+ * Query a SUNTAC RDPC101 RSSI archive.
+ *
+ * rdpc-archive [-a | -i] [-v] [-s serial] [-f freq] [-b begin] [-e end] file
+ *
+ * The blocks in the window are found by binary search in the index,
+ * file.idx; only blocks written after its last entry, or all of them
+ * without an index, are found by walking the block headers.  Aggregates
+ * of a block that lies wholly inside the window and holds one freq come
+ * from its header; other blocks are decoded.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "rdpc101.h"
+#include "librdpc101-priv.h"
+
+const char *program_name;
+
+enum arc_mode {
+	ARC_SAMPLES = 0,
+	ARC_AGGREGATE,
+	ARC_INDEX
+};
+
+struct arc_query {
+	const char *serial;
+	int freq;		/* 0 = any */
+	uint64_t begin, end;	/* us since the epoch */
+};
+
+struct arc_scan {
+	const char *path;
+	const uint8_t *base;
+	size_t size;
+	struct arc_query q;
+	enum arc_mode mode;
+	unsigned long searched;		/* headers looked at */
+	unsigned long blocks;		/* in range */
+	unsigned long decoded;
+};
+
+struct sample {
+	uint64_t t;
+	int32_t freq;
+	uint8_t rssi;
+	uint8_t stereo;
+};
+
+struct agg {
+	char serial[RDPC101_SERIAL_MAX];
+	int32_t freq;
+	uint64_t count;
+	uint64_t rssi_sum;
+	uint64_t stereo;
+	int rssi_min, rssi_max;
+	uint64_t first, last;
+};
+
+static struct agg *aggs;
+static int naggs;
+
+static uint32_t get_bits(const uint8_t *p, unsigned long *pos, int bits)
+{
+	uint32_t v = 0;
+	int i;
+
+	for (i = 0; i < bits; i++, (*pos)++)
+		if (p[*pos >> 3] & (1 << (*pos & 7)))
+			v |= (uint32_t) 1 << i;
+	return v;
+}
+
+/*
+ * Decode the payload of h into s; -1 if it is malformed.
+ */
+static int arc_decode(const struct rdpc101_arc_block *h, const uint8_t *p,
+		struct sample *s)
+{
+	const uint8_t *end = p + h->bytes;
+	unsigned long pos = 0;
+	int64_t delta = 0;
+	uint32_t i;
+
+	if (h->count == 0 || h->count > RDPC101_ARC_SAMPLES)
+		return -1;
+	s[0].t = h->t_first;
+	for (i = 1; i < h->count; i++)
+	{
+		uint64_t v = 0;
+		int shift = 0;
+
+		do
+		{
+			if (p >= end || shift > 63)
+				return -1;
+			v |= (uint64_t) (*p & 0x7f) << shift;
+			shift += 7;
+		} while (*p++ & 0x80);
+		delta += (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+		s[i].t = s[i - 1].t + delta;
+	}
+	if ((unsigned long) (end - p) * 8 < ((h->count * h->rssi_bits + 7) & ~7UL)
+			+ ((h->count * h->freq_bits + 7) & ~7UL) + h->count)
+		return -1;
+	for (i = 0; i < h->count; i++)
+		s[i].rssi = h->rssi_min + get_bits(p, &pos, h->rssi_bits);
+	pos = (pos + 7) & ~7UL;
+	for (i = 0; i < h->count; i++)
+		s[i].freq = h->freq_min + get_bits(p, &pos, h->freq_bits);
+	pos = (pos + 7) & ~7UL;
+	for (i = 0; i < h->count; i++)
+		s[i].stereo = get_bits(p, &pos, 1);
+	return 0;
+}
+
+static struct agg *agg_find(const char *serial, int32_t freq)
+{
+	struct agg *np;
+	int i;
+
+	for (i = 0; i < naggs; i++)
+		if (aggs[i].freq == freq && strcmp(aggs[i].serial, serial) == 0)
+			return &aggs[i];
+	if ((np = realloc(aggs, (naggs + 1) * sizeof *np)) == NULL)
+	{
+		perror("realloc");
+		exit(1);
+	}
+	aggs = np;
+	np = &aggs[naggs++];
+	memset(np, 0, sizeof *np);
+	snprintf(np->serial, sizeof np->serial, "%s", serial);
+	np->freq = freq;
+	np->rssi_min = 256;
+	np->rssi_max = -1;
+	return np;
+}
+
+static void agg_add(struct agg *a, uint64_t count, uint64_t sum,
+		uint64_t stereo, int min, int max, uint64_t first, uint64_t last)
+{
+	if (a->count == 0 || first < a->first)
+		a->first = first;
+	if (last > a->last)
+		a->last = last;
+	a->count += count;
+	a->rssi_sum += sum;
+	a->stereo += stereo;
+	if (min < a->rssi_min)
+		a->rssi_min = min;
+	if (max > a->rssi_max)
+		a->rssi_max = max;
+}
+
+static char *str_time(char *buf, size_t size, uint64_t us)
+{
+	time_t sec = us / 1000000;
+	size_t n;
+
+	n = strftime(buf, size, "%Y-%m-%dT%H:%M:%S", localtime(&sec));
+	snprintf(buf + n, size - n, ".%03u", (unsigned) (us / 1000 % 1000));
+	return buf;
+}
+
+/*
+ * Seconds since the epoch or local YYYY-MM-DDTHH:MM[:SS], in us.
+ */
+static int parse_time(const char *s, uint64_t *us)
+{
+	struct tm tm;
+	char *end;
+	time_t t;
+
+	memset(&tm, 0, sizeof tm);
+	if (strchr(s, 'T'))
+	{
+		if (sscanf(s, "%d-%d-%dT%d:%d:%d", &tm.tm_year, &tm.tm_mon,
+				&tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) < 5)
+			return -1;
+		tm.tm_year -= 1900;
+		tm.tm_mon -= 1;
+		tm.tm_isdst = -1;
+		if ((t = mktime(&tm)) == (time_t) -1)
+			return -1;
+	}
+	else
+	{
+		t = strtol(s, &end, 10);
+		if (*end != '\0')
+			return -1;
+	}
+	*us = (uint64_t) t * 1000000;
+	return 0;
+}
+
+static int arc_match(const struct arc_query *q, uint64_t t_first,
+		uint64_t t_last, const char *serial, int freq_min, int freq_max)
+{
+	return t_last >= q->begin && t_first < q->end
+			&& (!q->serial || strcmp(q->serial, serial) == 0)
+			&& (!q->freq || (q->freq >= freq_min && q->freq <= freq_max));
+}
+
+static void arc_block(struct arc_scan *sc, const struct rdpc101_arc_block *h,
+		size_t off)
+{
+	static struct sample s[RDPC101_ARC_SAMPLES];
+	const struct arc_query *q = &sc->q;
+	uint32_t k;
+
+	sc->blocks++;
+	if (sc->mode == ARC_INDEX)
+	{
+		char t0[32], t1[32];
+
+		printf("%10lu %s %s %-16s %5d-%-5d %5u rssi %3u-%-3u avg %5.1f\n",
+				(unsigned long) off, str_time(t0, sizeof t0, h->t_first),
+				str_time(t1, sizeof t1, h->t_last), h->serial, h->freq_min,
+				h->freq_max, h->count, h->rssi_min, h->rssi_max,
+				(double) h->rssi_sum / h->count);
+		return;
+	}
+	if (sc->mode == ARC_AGGREGATE && h->freq_min == h->freq_max
+			&& h->t_first >= q->begin && h->t_last < q->end)
+	{
+		agg_add(agg_find(h->serial, h->freq_min), h->count, h->rssi_sum,
+				h->stereo, h->rssi_min, h->rssi_max, h->t_first, h->t_last);
+		return;
+	}
+
+	if (arc_decode(h, sc->base + off + sizeof *h, s) < 0)
+	{
+		fprintf(stderr, "%s: bad block at offset %lu, skipped\n", sc->path,
+				(unsigned long) off);
+		return;
+	}
+	sc->decoded++;
+	for (k = 0; k < h->count; k++)
+	{
+		char stamp[32];
+
+		if (s[k].t < q->begin || s[k].t >= q->end
+				|| (q->freq && s[k].freq != q->freq))
+			continue;
+		if (sc->mode == ARC_AGGREGATE)
+			agg_add(agg_find(h->serial, s[k].freq), 1, s[k].rssi,
+					s[k].stereo, s[k].rssi, s[k].rssi, s[k].t, s[k].t);
+		else
+			printf("%s %s %5d %3u %s\n",
+					str_time(stamp, sizeof stamp, s[k].t), h->serial,
+					s[k].freq, s[k].rssi, s[k].stereo ? "stereo" : "mono");
+	}
+}
+
+/*
+ * Walk the block headers from off to the end of the archive.
+ */
+static void arc_walk(struct arc_scan *sc, size_t off)
+{
+	while (off < sc->size)
+	{
+		struct rdpc101_arc_block h;
+		size_t next;
+
+		if ((next = rdpc101_arc_resync(sc->base, sc->size, off, &h)) != off)
+		{
+			fprintf(stderr, "%s: skipped %lu damaged bytes at offset %lu\n",
+					sc->path, (unsigned long) (next - off),
+					(unsigned long) off);
+			if ((off = next) == sc->size)
+				break;
+		}
+		sc->searched++;
+		if (arc_match(&sc->q, h.t_first, h.t_last, h.serial, h.freq_min,
+				h.freq_max))
+			arc_block(sc, &h, off);
+		off += sizeof h + h.bytes;
+	}
+}
+
+/* first of the n entries whose key (t_max or t_floor) is at least t */
+static long arc_bound(const struct rdpc101_arc_index *ix, long n, uint64_t t,
+		int floor)
+{
+	long lo = 0, hi = n;
+
+	while (lo < hi)
+	{
+		long mid = lo + (hi - lo) / 2;
+
+		if ((floor ? ix[mid].t_floor : ix[mid].t_max) < t)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * Serve the query from the n index entries; returns the offset of the
+ * first block they do not cover.
+ */
+static size_t arc_search(struct arc_scan *sc,
+		const struct rdpc101_arc_index *ix, long n)
+{
+	struct rdpc101_arc_block h;
+	long i, hi;
+
+	/* blocks before lo end before begin; from hi on they start at end */
+	hi = arc_bound(ix, n, sc->q.end, TRUE);
+	for (i = arc_bound(ix, n, sc->q.begin, FALSE); i < hi; i++)
+	{
+		char serial[RDPC101_SERIAL_MAX];
+
+		sc->searched++;
+		snprintf(serial, sizeof serial, "%.*s", (int) sizeof serial - 1,
+				ix[i].serial);
+		if (!arc_match(&sc->q, ix[i].t_first, ix[i].t_last, serial,
+				ix[i].freq_min, ix[i].freq_max))
+			continue;
+		if (rdpc101_arc_header(sc->base, sc->size, ix[i].offset, &h) < 0
+				|| h.t_first != ix[i].t_first)
+		{
+			fprintf(stderr, "%s: index entry %ld does not match the archive\n",
+					sc->path, i);
+			continue;
+		}
+		arc_block(sc, &h, ix[i].offset);
+	}
+	rdpc101_arc_header(sc->base, sc->size, ix[n - 1].offset, &h);
+	return ix[n - 1].offset + sizeof h + h.bytes;
+}
+
+/*
+ * Map the index of path; NULL, with *n 0, if it is missing or does not
+ * match the archive.
+ */
+static const struct rdpc101_arc_index *
+arc_index_map(const struct arc_scan *sc, long *n, size_t *len)
+{
+	const struct rdpc101_arc_index *ix, *last;
+	char ipath[PATH_MAX];
+	struct rdpc101_arc_block h;
+	const char *p;
+	struct stat st;
+	int fd;
+
+	*n = 0;
+	snprintf(ipath, sizeof ipath, "%s" RDPC101_ARC_INDEX_SUFFIX, sc->path);
+	if ((fd = open(ipath, O_RDONLY)) < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof RDPC101_ARC_INDEX_MAGIC - 1
+			+ sizeof *ix)
+	{
+		close(fd);
+		return NULL;
+	}
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return NULL;
+	*len = st.st_size;
+	ix = (const struct rdpc101_arc_index *)
+			(p + sizeof RDPC101_ARC_INDEX_MAGIC - 1);
+	*n = (st.st_size - (sizeof RDPC101_ARC_INDEX_MAGIC - 1)) / sizeof *ix;
+	last = &ix[*n - 1];
+	if (memcmp(p, RDPC101_ARC_INDEX_MAGIC, sizeof RDPC101_ARC_INDEX_MAGIC - 1)
+			!= 0 || rdpc101_arc_header(sc->base, sc->size, last->offset, &h) < 0
+			|| h.t_first != last->t_first)
+	{
+		fprintf(stderr, "%s: does not match the archive, not used\n", ipath);
+		munmap((void *) p, st.st_size);
+		*n = 0;
+		return NULL;
+	}
+	return ix;
+}
+
+void usage(void)
+{
+	fprintf(stderr, "Usage: %s [-a | -i] [-v] [-s serial] [-f freq]"
+			" [-b begin] [-e end] file\n"
+			"  -a\t\taggregates per serial and freq\n"
+			"  -i\t\tlist the block index\n"
+			"  -v\t\treport blocks read and decoded\n"
+			"  -s serial\tonly this tuner\n"
+			"  -f freq\tonly this freq (10 KHz units on FM, KHz on AM)\n"
+			"  -b, -e time\twindow, seconds since the epoch or"
+			" YYYY-MM-DDTHH:MM[:SS]\n", program_name);
+}
+
+int main(int argc, char **argv)
+{
+	struct arc_query q = { NULL, 0, 0, UINT64_MAX };
+	enum arc_mode mode = ARC_SAMPLES;
+	const struct rdpc101_arc_index *ix;
+	struct arc_scan sc;
+	const uint8_t *base;
+	int verbose = 0;
+	struct stat st;
+	size_t off, ixlen = 0;
+	long nix;
+	int c, fd, i;
+
+	program_name = argv[0];
+	while ((c = getopt(argc, argv, "ab:e:f:is:v")) != -1)
+		switch (c)
+		{
+		case 'a':
+			mode = ARC_AGGREGATE;
+			break;
+		case 'b':
+		case 'e':
+			if (parse_time(optarg, c == 'b' ? &q.begin : &q.end) < 0)
+			{
+				fprintf(stderr, "invalid time: %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'f':
+			q.freq = atoi(optarg);
+			break;
+		case 'i':
+			mode = ARC_INDEX;
+			break;
+		case 's':
+			q.serial = optarg;
+			break;
+		case 'v':
+			verbose++;
+			break;
+		default:
+			usage();
+			exit(1);
+		}
+	if (optind != argc - 1)
+	{
+		usage();
+		exit(1);
+	}
+
+	if ((fd = open(argv[optind], O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+	{
+		perror(argv[optind]);
+		exit(1);
+	}
+	if (st.st_size < sizeof RDPC101_ARC_MAGIC - 1)
+	{
+		fprintf(stderr, "%s: not an archive\n", argv[optind]);
+		exit(1);
+	}
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+	{
+		perror(argv[optind]);
+		exit(1);
+	}
+	if (memcmp(base, RDPC101_ARC_MAGIC, sizeof RDPC101_ARC_MAGIC - 1) != 0)
+	{
+		fprintf(stderr, "%s: not an archive\n", argv[optind]);
+		exit(1);
+	}
+
+	memset(&sc, 0, sizeof sc);
+	sc.path = argv[optind];
+	sc.base = base;
+	sc.size = st.st_size;
+	sc.q = q;
+	sc.mode = mode;
+	off = sizeof RDPC101_ARC_MAGIC - 1;
+	if ((ix = arc_index_map(&sc, &nix, &ixlen)) != NULL)
+		off = arc_search(&sc, ix, nix);
+	arc_walk(&sc, off);
+
+	for (i = 0; i < naggs; i++)
+	{
+		const struct agg *a = &aggs[i];
+		char t0[32], t1[32];
+
+		printf("%-16s %5d %10llu rssi %3d-%-3d avg %5.1f stereo %5.1f%% %s %s\n",
+				a->serial, a->freq, (unsigned long long) a->count,
+				a->rssi_min, a->rssi_max, (double) a->rssi_sum / a->count,
+				100.0 * a->stereo / a->count,
+				str_time(t0, sizeof t0, a->first),
+				str_time(t1, sizeof t1, a->last));
+	}
+	if (verbose)
+		fprintf(stderr, "%ld blocks indexed, %lu headers read,"
+				" %lu blocks in range, %lu decoded\n", nix, sc.searched,
+				sc.blocks, sc.decoded);
+	free(aggs);
+	if (ix)
+		munmap((void *) ((const char *) ix
+				- (sizeof RDPC101_ARC_INDEX_MAGIC - 1)), ixlen);
+	munmap((void *) base, st.st_size);
+	exit(0);
+}
+
+/*-
+ * Copyright (c) 2009 NISHIO Yasuhiro <nishio@hh.iij4u.or.jp>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
@@ -0,0 +1,177 @@
+/*
+ * Dump a SUNTAC RDPC101 flight recorder ring, oldest record first.
+ *
+ * rdpc-recdump [-n count] file
+ *
+ * Works on the file left behind by a crashed process as well as on the
+ * ring of one still running; slots being written are skipped.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "rdpc101.h"
+#include "librdpc101-priv.h"
+
+const char *program_name;
+
+struct rec {
+	uint64_t seq;
+	struct rdpc101_rec_slot slot;
+};
+
+static int cmp_rec(const void *a, const void *b)
+{
+	uint64_t x = ((const struct rec *) a)->seq;
+	uint64_t y = ((const struct rec *) b)->seq;
+
+	return x < y ? -1 : x > y;
+}
+
+static void print_rec(const struct rec *r)
+{
+	const struct rdpc101_rec_slot *s = &r->slot;
+	time_t sec = s->t_ns / 1000000000;
+	char stamp[32];
+	int i;
+
+	strftime(stamp, sizeof stamp, "%Y-%m-%d %H:%M:%S", localtime(&sec));
+	printf("%10llu %s.%09llu %2d %-7s %4d ", (unsigned long long) r->seq - 1,
+			stamp, (unsigned long long) (s->t_ns % 1000000000), s->dev,
+			s->kind == RDPC101_REC_FEATURE ? "feature" :
+			s->kind == RDPC101_REC_INPUT ? "input" : "?", s->result);
+	for (i = 0; i < s->size && i < RDPC101_REC_DATA; i++)
+		printf("%2.2x ", s->data[i]);
+	if (s->size > RDPC101_REC_DATA)
+		printf("... (%d bytes)", s->size);
+	putchar('\n');
+}
+
+void usage(void)
+{
+	fprintf(stderr, "Usage: %s [-n count] file\n"
+			"  -n count\tonly the last count records\n"
+			"result: feature - bytes sent or <0; input - 1 valid, 0 anomalous,"
+			" <0 error\n", program_name);
+}
+
+int main(int argc, char **argv)
+{
+	const struct rdpc101_rec_header *h;
+	const struct rdpc101_rec_slot *slots;
+	struct rec *recs;
+	struct stat st;
+	long count = -1;
+	size_t n = 0, i;
+	int c, fd;
+
+	program_name = argv[0];
+	while ((c = getopt(argc, argv, "n:")) != -1)
+		switch (c)
+		{
+		case 'n':
+			count = atol(optarg);
+			break;
+		default:
+			usage();
+			exit(1);
+		}
+	if (optind != argc - 1)
+	{
+		usage();
+		exit(1);
+	}
+
+	if ((fd = open(argv[optind], O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+	{
+		perror(argv[optind]);
+		exit(1);
+	}
+	if (st.st_size < sizeof *h)
+	{
+		fprintf(stderr, "%s: not a recorder file\n", argv[optind]);
+		exit(1);
+	}
+	h = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (h == MAP_FAILED)
+	{
+		perror(argv[optind]);
+		exit(1);
+	}
+	if (memcmp(h->magic, RDPC101_REC_MAGIC, sizeof h->magic) != 0
+			|| h->slot_size != sizeof *slots
+			|| sizeof *h + (size_t) h->nslots * sizeof *slots > st.st_size)
+	{
+		fprintf(stderr, "%s: not a recorder file\n", argv[optind]);
+		exit(1);
+	}
+	slots = (const struct rdpc101_rec_slot *) (h + 1);
+
+	if ((recs = malloc(h->nslots * sizeof *recs)) == NULL)
+	{
+		perror("malloc");
+		exit(1);
+	}
+	for (i = 0; i < h->nslots; i++)
+	{
+		struct rdpc101_rec_slot *sp = (struct rdpc101_rec_slot *) &slots[i];
+		uint64_t seq = atomic_load_explicit(&sp->seq, memory_order_acquire);
+
+		if (seq == 0 || (seq - 1) % h->nslots != i)
+			continue;
+		memcpy(&recs[n].slot, sp, sizeof *sp);
+		/* rewritten while copying; the fence keeps the copy before it */
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&sp->seq, memory_order_relaxed) != seq)
+			continue;
+		recs[n++].seq = seq;
+	}
+	qsort(recs, n, sizeof *recs, cmp_rec);
+
+	i = (count >= 0 && count < n) ? n - count : 0;
+	for (; i < n; i++)
+		print_rec(&recs[i]);
+	free(recs);
+	munmap((void *) h, st.st_size);
+	exit(0);
+}
+
+/*-
+ * Copyright (c) 2009 NISHIO Yasuhiro <nishio@hh.iij4u.or.jp>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
@@ -4,8 +4,20 @@
  *
  * required: hidapi
  * http://www.signal11.us/oss/hidapi/
+ *
+ * rdpc-test [-d dev] hex...	send one feature report, read one status
+ * rdpc-test [-d dev] [-r] [-n count] [-i usec] -f script|-
+ *				replay a script of raw reports and report
+ *				throughput and latency
+ *
+ * Script lines:
+ *	hex... [*repeat]	send a feature report, repeat times
+ *	sleep usec		pause
+ *	read			read one status report
  */
 
+#include <ctype.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,20 +28,278 @@ struct dev_info *get_dev_info(void);
 
 __RCSID("$Id: rdpc-test.c,v 1.2 2009/07/07 13:33:53 nishio Exp $");
 
-int flag_verbose = 0;
+#define REPLAY_READ_TIMEOUT	100
+#define REPLAY_LINE_MAX		256
+#define HIST_BUCKETS		32
+
 const char *program_name;
 
+struct replay_stats {
+	long sent;
+	long failed;
+	long reads;
+	long read_timeouts;
+	long freq_mismatch;
+	uint64_t busy_us;
+	long set_hist[HIST_BUCKETS];	/* log2 usec */
+	long rtt_hist[HIST_BUCKETS];	/* report to next status */
+};
+
+static void hist_add(long *hist, uint64_t us)
+{
+	int b = 0;
+
+	while (us > 1 && b < HIST_BUCKETS - 1)
+	{
+		us >>= 1;
+		b++;
+	}
+	hist[b]++;
+}
+
+static void hist_print(const char *name, const long *hist)
+{
+	int b;
+
+	printf("%s (usec):\n", name);
+	for (b = 0; b < HIST_BUCKETS; b++)
+		if (hist[b])
+			printf("  %8lu .. %8lu: %ld\n", b ? 1UL << b : 0UL,
+					(2UL << b) - 1, hist[b]);
+}
+
+static int parse_report(char *s, unsigned char *buf, int size, long *repeat)
+{
+	char *tok;
+	int n = 0;
+
+	*repeat = 1;
+	for (tok = strtok(s, " \t"); tok; tok = strtok(NULL, " \t"))
+	{
+		if (*tok == '*')
+		{
+			if ((*repeat = atol(tok + 1)) < 1)
+				return -1;
+			continue;
+		}
+		if (n >= size || !isxdigit(*tok))
+			return -1;
+		buf[n++] = strtoul(tok, NULL, 16) & 0xff;
+	}
+	return n;
+}
+
+static int replay_read(struct rdpc101_dev *rp, struct replay_stats *st)
+{
+	int ret;
+
+	st->reads++;
+	if ((ret = rdpc101_read_state(rp, REPLAY_READ_TIMEOUT)) == 0)
+		st->read_timeouts++;
+	return ret;
+}
+
+/*
+ * Send one report.  With flag_read, time it to the first status report
+ * read after it; for RDPC_SETFREQ, to the first one showing the new
+ * freq.  Reports already queued are discarded first so they are not
+ * taken for the answer.
+ */
+static int replay_send(struct rdpc101_dev *rp, const unsigned char *report,
+		int size, int flag_read, struct replay_stats *st)
+{
+	unsigned char buf[RDPC101_REPORT_BUF];
+	int setfreq = report[0] == RDPC_SETFREQ && size >= RDPC101_REPORT_SIZE;
+	uint64_t t0, t1, deadline;
+	int got = FALSE;
+	int ret;
+
+	memcpy(buf, report, size);
+	if (flag_read)
+		while (rdpc101_read_state(rp, 0) > 0)
+			;
+	t0 = rdpc101_now_us();
+	ret = rdpc101_set_report(rp, buf, size);
+	t1 = rdpc101_now_us();
+	st->busy_us += t1 - t0;
+	hist_add(st->set_hist, t1 - t0);
+	if (ret < 0)
+	{
+		st->failed++;
+		return ret;
+	}
+	st->sent++;
+	if (!flag_read)
+		return 0;
+
+	st->reads++;
+	deadline = t0 + REPLAY_READ_TIMEOUT * 1000;
+	for (;;)
+	{
+		uint64_t now = rdpc101_now_us();
+
+		if (now >= deadline)
+		{
+			ret = 0;
+			break;
+		}
+		if ((ret = rdpc101_read_state(rp, (deadline - now + 999) / 1000)) <= 0)
+			break;
+		got = TRUE;
+		if (!setfreq || rp->cur.freq == (report[1] << 8 | report[2]))
+		{
+			hist_add(st->rtt_hist, rdpc101_now_us() - t0);
+			break;
+		}
+	}
+	if (ret == 0)
+	{
+		if (!got)
+			st->read_timeouts++;
+		else
+			st->freq_mismatch++;
+	}
+	return ret < 0 ? ret : 0;
+}
+
+static int replay(struct rdpc101_dev *rp, const char *path, long count,
+		long interval_us, int flag_read)
+{
+	struct replay_stats st;
+	char line[REPLAY_LINE_MAX];
+	uint64_t start, elapsed;
+	FILE *fp;
+	long pass;
+	int lineno;
+
+	if (strcmp(path, "-") == 0)
+		fp = stdin;
+	else if ((fp = fopen(path, "r")) == NULL)
+	{
+		perror(path);
+		return -1;
+	}
+	memset(&st, 0, sizeof st);
+	start = rdpc101_now_us();
+	for (pass = 0; pass < count; pass++)
+	{
+		if (pass > 0 && fseek(fp, 0, SEEK_SET) < 0)
+		{
+			fprintf(stderr, "%s: cannot rewind for -n\n", path);
+			break;
+		}
+		lineno = 0;
+		while (fgets(line, sizeof line, fp))
+		{
+			unsigned char report[RDPC101_REPORT_BUF];
+			long repeat, r;
+			char *s;
+			int size;
+
+			lineno++;
+			line[strcspn(line, "#\r\n")] = '\0';
+			for (s = line; isspace(*s); s++)
+				;
+			if (*s == '\0')
+				continue;
+			if (strncmp(s, "sleep", 5) == 0)
+			{
+				usleep(atol(s + 5));
+				continue;
+			}
+			if (strncmp(s, "read", 4) == 0)
+			{
+				replay_read(rp, &st);
+				continue;
+			}
+			if ((size = parse_report(s, report, sizeof report, &repeat)) <= 0)
+			{
+				fprintf(stderr, "%s:%d: syntax error\n", path, lineno);
+				goto out;
+			}
+			for (r = 0; r < repeat; r++)
+			{
+				if (replay_send(rp, report, size, flag_read, &st) < 0)
+					fprintf(stderr, "%s:%d: report failed\n", path, lineno);
+				if (interval_us > 0)
+					usleep(interval_us);
+			}
+		}
+	}
+out:
+	elapsed = rdpc101_now_us() - start;
+	if (fp != stdin)
+		fclose(fp);
+
+	printf("%ld reports sent, %ld failed in %.3f s: %.1f reports/s"
+			" (%.1f/s while sending)\n", st.sent, st.failed, elapsed / 1e6,
+			elapsed ? st.sent * 1e6 / elapsed : 0.0,
+			st.busy_us ? (st.sent + st.failed) * 1e6 / st.busy_us : 0.0);
+	hist_print("set_report", st.set_hist);
+	if (st.reads)
+	{
+		printf("%ld status reads, %ld timeouts, %ld freq mismatches\n",
+				st.reads, st.read_timeouts, st.freq_mismatch);
+		hist_print("report to status", st.rtt_hist);
+	}
+	return st.failed ? -1 : 0;
+}
+
+void usage(void)
+{
+	fprintf(stderr, "Usage: %s [-d dev_index] hex...\n"
+			"       %s [-d dev_index] [-r] [-n count] [-i usec] -f file|-\n"
+			"  -f file\treplay raw reports from file (- for stdin)\n"
+			"  -n count\treplay the file count times\n"
+			"  -i usec\tpause between reports\n"
+			"  -r\t\tread a status report after each report\n",
+			program_name, program_name);
+}
+
 int main(int argc, char **argv)
 {
 	int ret;
 	struct dev_info *dev_info;
 	struct rdpc101_dev *rdpc101_list;
 	struct rdpc101_dev *rp;
+	int c;
 	int i;
 	int size;
-	void usage(void);
+	int dev_index = 0;
+	int flag_read = 0;
+	long count = 1;
+	long interval_us = 0;
+	const char *replay_file = NULL;
 	unsigned char buf[64];
 
+	program_name = argv[0];
+	while ((c = getopt(argc, argv, "d:f:i:n:r")) != -1)
+		switch (c)
+		{
+		case 'd':
+			dev_index = atoi(optarg);
+			break;
+		case 'f':
+			replay_file = optarg;
+			break;
+		case 'i':
+			interval_us = atol(optarg);
+			break;
+		case 'n':
+			if ((count = atol(optarg)) < 1)
+			{
+				usage();
+				exit(1);
+			}
+			break;
+		case 'r':
+			flag_read++;
+			break;
+		default:
+			usage();
+			exit(1);
+		}
+
 	if ((dev_info = get_dev_info()) == NULL )
 	{
 		perror("make_dev_info");
@@ -49,19 +319,26 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
-	if (!(rp = rdpc101_device(rdpc101_list, 0)))
+	if (!(rp = rdpc101_device(rdpc101_list, dev_index)))
 	{
 		fprintf(stderr, "invalid dev_index\n");
 		rdpc101_cleanup(dev_info);
 		exit(1);
 	}
 
+	if (replay_file)
+	{
+		ret = replay(rp, replay_file, count, interval_us, flag_read);
+		rdpc101_cleanup(dev_info);
+		exit(ret < 0 ? 1 : 0);
+	}
+
 	memset(buf, 0, sizeof buf);
-	for (i = 0; argv[i + 1] && i < sizeof buf; i++)
+	for (i = 0; argv[optind + i] && i < sizeof buf; i++)
 	{
 		int tmp;
 
-		sscanf(argv[i + 1], "%x", &tmp);
+		sscanf(argv[optind + i], "%x", &tmp);
 		buf[i] = tmp & 0xff;
 	}
 	size = i;
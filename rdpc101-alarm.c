@@ -0,0 +1,448 @@
+/*
+ * Alarm engine for SUNTAC RDPC101.
+ *
+ * Rules are bound to a (device, freq) pair when loaded and hashed on
+ * it; each decoded status report looks up the rules of the station the
+ * device is on, plus the drift rules of the device, and evaluates only
+ * those.  Rules for stations no tuner is on cost nothing.  A rule
+ * changes state once its condition has held for the minimum duration;
+ * RSSI rules release only past the hysteresis band.  Every change is
+ * written as an event line on stdout and, with a hook, passed to
+ * /bin/sh -c hook in the environment:
+ *	RDPC_ALARM_SERIAL RDPC_ALARM_FREQ RDPC_ALARM_RULE RDPC_ALARM_STATE
+ *	RDPC_ALARM_VALUE
+ *
+ * Rule lines (serial is a device serial number or #index; other lines
+ * starting with # are comments):
+ *	serial freq rssi-below level [hyst n] [for ms]
+ *	serial freq rssi-above level [hyst n] [for ms]
+ *	serial freq stereo-lost [for ms]
+ *	serial freq drift steps [for ms]
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include "rdpc101.h"
+#include "rdpc101-cli.h"
+
+#define ALARM_LINE_MAX		256
+#define ALARM_POLL_MS		50
+#define ALARM_HYSTERESIS	3
+#define ALARM_VARS		5	/* RDPC_ALARM_* */
+
+extern char **environ;
+
+enum alarm_kind {
+	ALARM_RSSI_BELOW = 0,
+	ALARM_RSSI_ABOVE,
+	ALARM_STEREO_LOST,
+	ALARM_DRIFT
+};
+
+static const char *const alarm_names[] = {
+	"rssi-below", "rssi-above", "stereo-lost", "drift"
+};
+
+struct alarm_rule {
+	struct alarm_rule *next;	/* same station, or same device (drift) */
+	char serial[RDPC101_SERIAL_MAX];
+	int dev;
+	int freq;
+	enum alarm_kind kind;
+	int level;
+	int hyst;
+	long for_ms;
+	uint64_t since_us;	/* state has differed since, 0 = not */
+	int active;
+};
+
+struct alarm_station {
+	struct alarm_station *hnext;
+	int dev;
+	int freq;
+	struct alarm_rule *rules;
+};
+
+struct alarms {
+	struct alarm_rule *rule;
+	int nrules;
+	struct alarm_station *st;
+	struct alarm_station **hash;
+	unsigned mask;
+	struct alarm_station **last;	/* per device index */
+	struct alarm_rule **drift;	/* per device index */
+	int ndev;
+	const char *hook;
+};
+
+static unsigned alarm_hash(int dev, int freq)
+{
+	return ((unsigned) dev * 0x9e3779b1U) ^ (unsigned) freq * 0x85ebca6bU;
+}
+
+static struct alarm_station *alarm_lookup(struct alarms *a, int dev, int freq)
+{
+	struct alarm_station *s;
+
+	for (s = a->hash[alarm_hash(dev, freq) & a->mask]; s; s = s->hnext)
+		if (s->dev == dev && s->freq == freq)
+			return s;
+	return NULL;
+}
+
+static int alarm_parse(char *line, struct rdpc101_dev *list, int expert,
+		struct alarm_rule *r)
+{
+	char *serial, *freqs, *kind, *arg;
+	struct rdpc101_dev *rp;
+
+	memset(r, 0, sizeof *r);
+	if ((serial = strtok(line, " \t")) == NULL
+			|| (freqs = strtok(NULL, " \t")) == NULL
+			|| (kind = strtok(NULL, " \t")) == NULL
+			|| (r->freq = parse_freq(freqs, expert, NULL)) <= 0)
+		return -1;
+	for (r->kind = ALARM_RSSI_BELOW; r->kind <= ALARM_DRIFT; r->kind++)
+		if (strcasecmp(kind, alarm_names[r->kind]) == 0)
+			break;
+	if (r->kind > ALARM_DRIFT)
+		return -1;
+	if (r->kind != ALARM_STEREO_LOST)
+	{
+		if ((arg = strtok(NULL, " \t")) == NULL)
+			return -1;
+		r->level = atoi(arg);
+	}
+	r->hyst = ALARM_HYSTERESIS;
+	while ((arg = strtok(NULL, " \t")) != NULL)
+	{
+		char *val = strtok(NULL, " \t");
+
+		if (val == NULL)
+			return -1;
+		if (strcasecmp(arg, "hyst") == 0)
+			r->hyst = atoi(val);
+		else if (strcasecmp(arg, "for") == 0)
+			r->for_ms = atol(val);
+		else
+			return -1;
+	}
+
+	if (*serial == '#' && isdigit(serial[1]))
+		rp = rdpc101_device(list, atoi(serial + 1));
+	else
+		rp = rdpc101_device_by_serial(list, serial);
+	if (!rp)
+		return -2;
+	r->dev = rp->index;
+	snprintf(r->serial, sizeof r->serial, "%s", serial);
+	return 0;
+}
+
+static int alarm_load(struct alarms *a, const char *path,
+		struct rdpc101_dev *list, int expert)
+{
+	char line[ALARM_LINE_MAX];
+	int lineno = 0, nst = 0;
+	unsigned size;
+	FILE *fp;
+	int i;
+
+	if ((fp = fopen(path, "r")) == NULL)
+	{
+		perror(path);
+		return -1;
+	}
+	while (fgets(line, sizeof line, fp))
+	{
+		struct alarm_rule r, *np;
+		char *p = line + strspn(line, " \t");
+		int ret;
+
+		lineno++;
+		line[strcspn(line, "\r\n")] = '\0';
+		/* #index is a device, # followed by anything else a comment */
+		if (*p == '\0' || (*p == '#' && !isdigit(p[1])))
+			continue;
+		if ((ret = alarm_parse(line, list, expert, &r)) < 0)
+		{
+			Error("%s:%d: %s", path, lineno,
+					ret == -2 ? "no such device" : "syntax error");
+			fclose(fp);
+			return -1;
+		}
+		if ((np = realloc(a->rule, (a->nrules + 1) * sizeof *np)) == NULL)
+		{
+			perror("realloc");
+			fclose(fp);
+			return -1;
+		}
+		a->rule = np;
+		a->rule[a->nrules++] = r;
+	}
+	fclose(fp);
+	if (a->nrules == 0)
+	{
+		Error("%s: no rules", path);
+		return -1;
+	}
+
+	for (size = 16; size < 2U * a->nrules; size <<= 1)
+		;
+	a->mask = size - 1;
+	if ((a->hash = calloc(size, sizeof *a->hash)) == NULL
+			|| (a->st = calloc(a->nrules, sizeof *a->st)) == NULL)
+		return -1;
+	for (i = 0; i < a->nrules; i++)
+	{
+		struct alarm_rule *r = &a->rule[i];
+		struct alarm_station *s;
+
+		if (r->kind == ALARM_DRIFT)
+		{
+			r->next = a->drift[r->dev];
+			a->drift[r->dev] = r;
+			continue;
+		}
+		if ((s = alarm_lookup(a, r->dev, r->freq)) == NULL)
+		{
+			unsigned h = alarm_hash(r->dev, r->freq) & a->mask;
+
+			s = &a->st[nst++];
+			s->dev = r->dev;
+			s->freq = r->freq;
+			s->hnext = a->hash[h];
+			a->hash[h] = s;
+		}
+		r->next = s->rules;
+		s->rules = r;
+	}
+	Notice("%s: %d rules on %d stations", path, a->nrules, nst);
+	return 0;
+}
+
+static void alarm_fire(struct alarms *a, const struct alarm_rule *r, int value)
+{
+	char freqstr[FREQSTR_MAX];
+	const char *state = r->active ? "fired" : "cleared";
+	time_t now = time(NULL);
+	char stamp[32];
+
+	sstr_freq(freqstr, sizeof freqstr, r->freq);
+	strftime(stamp, sizeof stamp, "%Y-%m-%dT%H:%M:%S", localtime(&now));
+	printf("%s %s %s %s %s %d\n", stamp, r->serial, freqstr,
+			alarm_names[r->kind], state, value);
+
+	if (a->hook)
+	{
+		/* only async-signal-safe calls in the child: build it all here */
+		char vars[ALARM_VARS][RDPC101_SERIAL_MAX + 32];
+		char **envp;
+		int i, n;
+
+		for (n = 0; environ[n]; n++)
+			;
+		if ((envp = malloc((n + ALARM_VARS + 1) * sizeof *envp)) == NULL)
+		{
+			perror("malloc");
+			return;
+		}
+		snprintf(vars[0], sizeof vars[0], "RDPC_ALARM_SERIAL=%s", r->serial);
+		snprintf(vars[1], sizeof vars[1], "RDPC_ALARM_FREQ=%s", freqstr);
+		snprintf(vars[2], sizeof vars[2], "RDPC_ALARM_RULE=%s",
+				alarm_names[r->kind]);
+		snprintf(vars[3], sizeof vars[3], "RDPC_ALARM_STATE=%s", state);
+		snprintf(vars[4], sizeof vars[4], "RDPC_ALARM_VALUE=%d", value);
+		for (i = 0; i < ALARM_VARS; i++)
+			envp[i] = vars[i];
+		for (n = 0; environ[n]; n++)
+			if (strncmp(environ[n], "RDPC_ALARM_", 11) != 0)
+				envp[i++] = environ[n];
+		envp[i] = NULL;
+		if (fork() == 0)
+		{
+			execle("/bin/sh", "sh", "-c", a->hook, (char *) NULL, envp);
+			_exit(127);
+		}
+		free(envp);
+	}
+}
+
+static void alarm_eval(struct alarms *a, struct alarm_rule *r,
+		struct rdpc101_dev *rp, uint64_t now)
+{
+	int value = rp->cur.sig_intensity;
+	int cond;
+
+	switch (r->kind)
+	{
+	case ALARM_RSSI_BELOW:
+		cond = value < r->level + (r->active ? r->hyst : 0);
+		break;
+	case ALARM_RSSI_ABOVE:
+		cond = value > r->level - (r->active ? r->hyst : 0);
+		break;
+	case ALARM_STEREO_LOST:
+		value = rp->cur.ma & RDPC_MA_STEREO;
+		cond = !value;
+		break;
+	case ALARM_DRIFT:
+	default:
+		value = rp->cur.freq;
+		cond = abs(value - r->freq) > r->level * rdpc101_step(r->freq);
+		break;
+	}
+	if (cond == r->active)
+	{
+		r->since_us = 0;
+		return;
+	}
+	if (r->since_us == 0)
+		r->since_us = now;
+	if (now - r->since_us < (uint64_t) r->for_ms * 1000)
+		return;
+	r->active = cond;
+	r->since_us = 0;
+	alarm_fire(a, r, value);
+}
+
+/*
+ * A condition counts only while it holds on consecutive reports of the
+ * station; leaving it, even to seek, starts the duration over.
+ */
+static void alarm_restart(struct alarm_rule *r)
+{
+	for (; r; r = r->next)
+		r->since_us = 0;
+}
+
+static void alarm_update(struct rdpc101_dev *rp, void *arg)
+{
+	struct alarms *a = arg;
+	struct alarm_station *s;
+	struct alarm_rule *r;
+	uint64_t now;
+
+	if (rp->index >= a->ndev)
+		return;
+	s = a->last[rp->index];
+	if (rp->cur.ma & RDPC_MA_SEEKING_MASK)
+	{
+		alarm_restart(a->drift[rp->index]);
+		if (s)
+			alarm_restart(s->rules);
+		a->last[rp->index] = NULL;
+		return;
+	}
+	now = rdpc101_now_us();
+	for (r = a->drift[rp->index]; r; r = r->next)
+		alarm_eval(a, r, rp, now);
+	if (s == NULL || s->freq != rp->cur.freq)
+	{
+		if (s)
+			alarm_restart(s->rules);
+		s = a->last[rp->index] = alarm_lookup(a, rp->index, rp->cur.freq);
+	}
+	if (s)
+		for (r = s->rules; r; r = r->next)
+			alarm_eval(a, r, rp, now);
+}
+
+/*
+ * Evaluate the rules in path against every device until interrupted.
+ */
+int rdpc101_alarm(struct rdpc101_dev *list, const char *path, const char *hook,
+		int expert)
+{
+	struct rdpc101_reactor *r = NULL;
+	struct rdpc101_dev *p;
+	struct alarms a;
+	int ret = -1;
+
+	memset(&a, 0, sizeof a);
+	a.hook = hook;
+	for (p = list; p; p = p->next)
+		a.ndev = p->index + 1;
+	if ((a.last = calloc(a.ndev, sizeof *a.last)) == NULL
+			|| (a.drift = calloc(a.ndev, sizeof *a.drift)) == NULL
+			|| alarm_load(&a, path, list, expert) < 0)
+		goto out;
+	if (rdpc101_add_state_hook(alarm_update, &a) < 0)
+	{
+		Error("Cannot hook status reports");
+		goto out;
+	}
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	if (rdpc101_fileno(list) >= 0 && (r = rdpc101_reactor_new(NULL, NULL)))
+		for (p = list; p; p = p->next)
+			if (rdpc101_reactor_add(r, p) < 0)
+			{
+				Error("Cannot watch dev %d", p->index);
+				goto unhook;
+			}
+
+	for (;;)
+	{
+		if (r)
+			ret = rdpc101_reactor_run(r, 1000);
+		else
+			for (p = list, ret = 0; p && ret >= 0; p = p->next)
+				ret = rdpc101_read_state(p, ALARM_POLL_MS);
+		if (ret < 0)
+			break;
+		while (waitpid(-1, NULL, WNOHANG) > 0)
+			;
+	}
+unhook:
+	rdpc101_del_state_hook(alarm_update, &a);
+	rdpc101_reactor_free(r);
+out:
+	free(a.rule);
+	free(a.st);
+	free(a.hash);
+	free(a.last);
+	free(a.drift);
+	return ret;
+}
+
+/*-
+ * Copyright (c) 2009 NISHIO Yasuhiro <nishio@hh.iij4u.or.jp>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
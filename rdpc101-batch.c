@@ -0,0 +1,304 @@
+/*
+ * Batch command mode for SUNTAC RDPC101.
+ *
+ * Reads newline-delimited commands and runs them against handles that
+ * stay open for the whole run, so a tune/measure/retune sequence costs
+ * only its USB transfers.  The commanded band and frequency are kept,
+ * so the device is read only for status and seek (and once, if the band
+ * is not yet known).  One result line is written per command:
+ *
+ *	ok|err <usec> <command> [result]
+ *
+ * Commands:
+ *	dev N			select device N
+ *	status			read one status report
+ *	band am|fm		switch band
+ *	tune FREQ		tune, switching band if needed
+ *	stereo | mono		set audio mode
+ *	mute on|off
+ *	seek up|down		seek and wait for the tuner to stop
+ *	sleep MSEC
+ * Blank lines and lines starting with '#' are ignored.
+ */
+
+#include <sys/types.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include "rdpc101.h"
+#include "rdpc101-cli.h"
+
+#define BATCH_LINE_MAX	256
+#define BATCH_RESULT_MAX	64
+
+struct batch_ctx {
+	struct rdpc101_dev *list;
+	struct rdpc101_dev *rp;
+	int expert;
+	enum rdpc_band band;	/* as last commanded or read, <0 unknown */
+	int freq;		/* likewise, 0 unknown */
+};
+
+static void batch_forget(struct batch_ctx *ctx)
+{
+	ctx->band = RDPC_BAND_UNKNOWN;
+	ctx->freq = 0;
+}
+
+static void batch_learn(struct batch_ctx *ctx)
+{
+	ctx->freq = ctx->rp->cur.freq;
+	ctx->band = rdpc101_band(ctx->freq);
+}
+
+static int batch_wait_seek(struct rdpc101_dev *rp)
+{
+	uint64_t t0 = rdpc101_now_us();
+	int ret;
+
+	while ((ret = rdpc101_read_state(rp, -1)) >= 0)
+		/* the first reports may predate the seek */
+		if (ret > 0 && !(rp->cur.ma & RDPC_MA_SEEKING_MASK)
+				&& rdpc101_now_us() - t0 >= RDPC101_SEEK_SETTLE_US)
+			break;
+	return ret;
+}
+
+static int batch_band(struct batch_ctx *ctx, enum rdpc_band band)
+{
+	int ret;
+
+	if (ctx->band < 0)
+	{
+		if (rdpc101_update_state(ctx->rp) < 0)
+			return -1;
+		batch_learn(ctx);
+	}
+	if (band == ctx->band)
+		return 0;
+	if ((ret = rdpc101_set_band(ctx->rp, band)) < 0)
+	{
+		batch_forget(ctx);
+		return ret;
+	}
+	/* the band switch retunes to a frequency we do not know */
+	ctx->band = band;
+	ctx->freq = 0;
+	return 0;
+}
+
+static int batch_exec(struct batch_ctx *ctx, char *cmd, char *arg,
+		char *result, int size)
+{
+	struct rdpc101_dev *rp = ctx->rp;
+	int ret;
+
+	*result = '\0';
+	if (strcmp(cmd, "dev") == 0)
+	{
+		struct rdpc101_dev *np;
+
+		if (!arg || !isdigit(*arg)
+				|| !(np = rdpc101_device(ctx->list, atoi(arg))))
+			return -1;
+		ctx->rp = np;
+		batch_forget(ctx);
+		return 0;
+	}
+	if (strcmp(cmd, "status") == 0)
+	{
+		char freqstr[FREQSTR_MAX];
+
+		if ((ret = rdpc101_update_state(rp)) < 0)
+			return ret;
+		batch_learn(ctx);
+		snprintf(result, size, "%s %s %d",
+				sstr_freq(freqstr, sizeof freqstr, rp->cur.freq),
+				str_ma(rp->cur.ma & ~RDPC_MA_SEEKING_MASK),
+				rp->cur.sig_intensity);
+		return 0;
+	}
+	if (strcmp(cmd, "band") == 0)
+	{
+		if (!arg)
+			return -1;
+		if (strcasecmp(arg, "am") == 0)
+			return batch_band(ctx, RDPC_BAND_AM);
+		if (strcasecmp(arg, "fm") == 0)
+			return batch_band(ctx, RDPC_BAND_FM);
+		return -1;
+	}
+	if (strcmp(cmd, "tune") == 0)
+	{
+		int freq;
+
+		if (!arg || (freq = parse_freq(arg, ctx->expert, NULL)) <= 0)
+			return -1;
+		if ((ret = batch_band(ctx, rdpc101_band(freq))) < 0)
+			return ret;
+		if ((ret = rdpc101_set_freq(rp, freq)) < 0)
+		{
+			batch_forget(ctx);
+			return ret;
+		}
+		ctx->freq = freq;
+		return 0;
+	}
+	if (strcmp(cmd, "stereo") == 0)
+		return rdpc101_set_ma(rp, RDPC_MA_STEREO);
+	if (strcmp(cmd, "mono") == 0)
+		return rdpc101_set_ma(rp, RDPC_MA_MONO);
+	if (strcmp(cmd, "mute") == 0)
+	{
+		if (!arg)
+			return -1;
+		if (strcasecmp(arg, "on") == 0)
+			return rdpc101_mute(rp, RDPC_MUTE_ON);
+		if (strcasecmp(arg, "off") == 0)
+			return rdpc101_mute(rp, RDPC_MUTE_OFF);
+		return -1;
+	}
+	if (strcmp(cmd, "seek") == 0)
+	{
+		enum rdpc_seek dir;
+		int ofreq = ctx->freq;
+		char freqstr[FREQSTR_MAX];
+
+		if (!arg)
+			return -1;
+		if (strcasecmp(arg, "up") == 0)
+			dir = RDPC_SEEK_UP;
+		else if (strcasecmp(arg, "down") == 0)
+			dir = RDPC_SEEK_DOWN;
+		else
+			return -1;
+		rdpc101_mute(rp, RDPC_MUTE_ON);
+		if ((ret = rdpc101_seek(rp, dir)) >= 0)
+			ret = batch_wait_seek(rp);
+		/* retuning stops the seek where it is */
+		if (ret < 0 && rdpc101_cancelled() && ofreq > 0)
+			rdpc101_set_freq(rp, ofreq);
+		rdpc101_mute(rp, RDPC_MUTE_OFF);
+		if (ret < 0)
+		{
+			batch_forget(ctx);
+			return ret;
+		}
+		batch_learn(ctx);
+		snprintf(result, size, "%s %d",
+				sstr_freq(freqstr, sizeof freqstr, rp->cur.freq),
+				rp->cur.sig_intensity);
+		return 0;
+	}
+	if (strcmp(cmd, "sleep") == 0)
+	{
+		struct timespec t;
+		long msec;
+
+		if (!arg || (msec = atol(arg)) < 0)
+			return -1;
+		t.tv_sec = msec / 1000;
+		t.tv_nsec = (msec % 1000) * 1000 * 1000;
+		return nanosleep(&t, NULL);
+	}
+	return -1;
+}
+
+int rdpc101_batch(struct rdpc101_dev *list, int dev_index, const char *path,
+		int expert)
+{
+	struct batch_ctx ctx;
+	char line[BATCH_LINE_MAX];
+	FILE *fp;
+	int errors = 0;
+
+	if (strcmp(path, "-") == 0)
+		fp = stdin;
+	else if ((fp = fopen(path, "r")) == NULL)
+	{
+		perror(path);
+		return -1;
+	}
+	ctx.list = list;
+	ctx.expert = expert;
+	batch_forget(&ctx);
+	if (!(ctx.rp = rdpc101_device(list, dev_index)))
+	{
+		Error("invalid dev_index: %d", dev_index);
+		if (fp != stdin)
+			fclose(fp);
+		return -1;
+	}
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	/* a cancel ends the run after the command it interrupted */
+	while (!rdpc101_cancelled() && fgets(line, sizeof line, fp))
+	{
+		char result[BATCH_RESULT_MAX];
+		struct timespec t0, t1;
+		char *cmd, *arg;
+		long usec;
+		int ret;
+
+		line[strcspn(line, "\r\n")] = '\0';
+		if ((cmd = strtok(line, " \t")) == NULL || *cmd == '#')
+			continue;
+		arg = strtok(NULL, " \t");
+
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		ret = batch_exec(&ctx, cmd, arg, result, sizeof result);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		usec = (t1.tv_sec - t0.tv_sec) * 1000000
+				+ (t1.tv_nsec - t0.tv_nsec) / 1000;
+
+		if (ret < 0)
+			errors++;
+		printf("%s %ld %s%s%s%s%s\n", ret < 0 ? "err" : "ok", usec, cmd,
+				arg ? " " : "", arg ? arg : "", *result ? " " : "", result);
+	}
+	if (fp != stdin)
+		fclose(fp);
+	if (rdpc101_cancelled())
+	{
+		errno = ECANCELED;
+		return -1;
+	}
+	return errors ? -1 : 0;
+}
+
+/*-
+ * Copyright (c) 2009 NISHIO Yasuhiro <nishio@hh.iij4u.or.jp>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
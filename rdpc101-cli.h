@@ -0,0 +1,168 @@
+/*
+ * Shared declarations for the rdpc101 control program.
+ */
+#if !defined(__RDPC101_CLI_H)
+#define __RDPC101_CLI_H
+#include <signal.h>
+#include <stdio.h>
+#include "rdpc101.h"
+
+#define ISTRING_MAX	512
+#define WATCH_POLL_REPORT_US	10000000	/* --poll jitter summary */
+#define FREQ_MAX_WIDTH_STR	"108.00 MHz"
+#define FREQ_MAX_WIDTH	(sizeof (FREQ_MAX_WIDTH_STR) - 1)
+#define FREQSTR_MAX	((FREQ_MAX_WIDTH + 1 + sizeof (int) - 1) & ~(sizeof (int) - 1))
+
+/*
+ * Utils
+ */
+#if !defined(Info)
+#define Info(fmt, arg...)						\
+    do {								\
+	if (rdpc101_verbose() > 1)					\
+	    fprintf(stderr, __FILE__ "(%d): " fmt "\n", __LINE__, ## arg); \
+    } while (0)
+
+#define Info_packet(label, buf, size)					\
+    do {								\
+	if (rdpc101_verbose() > 1)					\
+	    rdpc101_log_packet(NULL, label, buf, size);		\
+    } while (0)
+#define Notice(fmt, arg...)						\
+    do {								\
+	if (rdpc101_verbose() > 0)					\
+	    fprintf(stderr, __FILE__ "(%d): " fmt "\n", __LINE__, ## arg); \
+    } while (0)
+#define Warn(fmt, arg...)						\
+    do {								\
+	fprintf(stderr, __FILE__ "(%d): " fmt "\n", __LINE__, ## arg);	\
+    } while (0)
+
+#define Error(fmt, arg...)						\
+    do {								\
+	fprintf(stderr, __FILE__ "(%d): " fmt "\n", __LINE__, ## arg);	\
+    } while (0)
+
+#if defined(DEBUG)
+#define Debug(fmt, arg...)						\
+    do {								\
+	fprintf(stderr, __FILE__ "(%d): " fmt "\n", __LINE__, ## arg);	\
+    } while (0)
+#else
+#define Debug(fmt, arg...) do {} while (0)
+#endif
+#endif
+
+extern const char *program_name;
+
+struct dev_info *get_dev_info(void);
+void rdpc101_list_device(struct rdpc101_dev *rp);
+char *sstr_freq(char *buf, int size, int freq);
+char const *str_ma(enum rdpc_ma ma);
+int parse_freq(const char *s, int expert, enum rdpc_ma *ma);
+unsigned long parse_cpus(const char *s);
+void set_signal_handlers(void);
+sigset_t block_sigs();
+void unblock_sigs(sigset_t sigs);
+void exit_if_cancelled(void);
+void display_freq(struct rdpc101_dev *rp);
+int rdpc101_display_seeking(struct rdpc101_dev *rp);
+int rdpc101_watch_state(struct rdpc101_dev *rp, int deadband);
+int rdpc101_watch_all(struct rdpc101_dev *list, int deadband);
+int rdpc101_watch_poll(struct rdpc101_dev *rp, int deadband, long period_us,
+		long count);
+int rdpc101_scan(struct rdpc101_dev *list, struct rdpc101_dev *rp,
+		enum rdpc_band band);
+
+/* rdpc101-waterfall.c */
+enum waterfall_format {
+	WATERFALL_ANSI = 0,
+	WATERFALL_BINARY
+};
+
+struct waterfall_opts {
+	int freq_min;
+	int freq_max;
+	int step;
+	int threshold;		/* minimum RSSI change to report */
+	int depth;		/* sweeps kept in the ring for peak hold */
+	long count;		/* sweeps to run, 0 = until interrupted */
+	enum waterfall_format format;
+	int dwell_ms;		/* a cell waits a few of these for lock */
+};
+
+int parse_freq_range(const char *s, int expert, int *freq_min, int *freq_max);
+int rdpc101_waterfall(struct rdpc101_dev *rp, const struct waterfall_opts *opts);
+
+/* rdpc101-measure.c */
+int rdpc101_measure_tune(struct rdpc101_dev *rp, int repeat);
+
+/* rdpc101-schedule.c */
+int rdpc101_schedule(struct rdpc101_dev *list, const char *path, int expert);
+
+/* rdpc101-hscan.c */
+struct hscan_opts {
+	enum rdpc_band band;
+	int stride;		/* coarse pass samples every stride steps */
+	int floor;		/* noise floor, -1 = coarse median + margin */
+};
+
+int rdpc101_hscan(struct rdpc101_dev *rp, const struct hscan_opts *opts);
+
+/* rdpc101-monitor.c */
+int rdpc101_monitor(struct rdpc101_dev *list, const char *path, int interval,
+		int dropout);
+
+/* rdpc101-memscan.c */
+struct memscan_opts {
+	const char *path;	/* channel list */
+	int expert;
+	int dwell_ms;		/* minimum time on each channel */
+	int squelch;		/* RSSI that holds the scan */
+	long count;		/* passes to run, 0 = until interrupted */
+};
+
+int rdpc101_memscan(struct rdpc101_dev *rp, const struct memscan_opts *opts);
+
+/* rdpc101-alarm.c */
+int rdpc101_alarm(struct rdpc101_dev *list, const char *path, const char *hook,
+		int expert);
+
+/* rdpc101-batch.c */
+int rdpc101_batch(struct rdpc101_dev *list, int dev_index, const char *path,
+		int expert);
+
+#endif
+
+/*-
+ * Copyright (c) 2009 NISHIO Yasuhiro <nishio@hh.iij4u.or.jp>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
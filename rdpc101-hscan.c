@@ -0,0 +1,201 @@
+/*
+ * Coarse-to-fine band scan for SUNTAC RDPC101.
+ *
+ * First samples a sub-band every `stride' native steps, then retunes
+ * channel by channel only around coarse samples above the noise floor
+ * and reports the local RSSI peaks found there.  In a sparse band this
+ * needs a fraction of the retunes of a full sweep.  Each rfd entry of
+ * the band is scanned at its own step.
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "rdpc101.h"
+#include "rdpc101-cli.h"
+
+#define HSCAN_FLOOR_MARGIN	3
+
+static int cmp_int(const void *a, const void *b)
+{
+	return *(const int *) a - *(const int *) b;
+}
+
+static int hscan_sample(struct rdpc101_dev *rp, int *rssi, int min, int step,
+		int i, int *retunes)
+{
+	int ret;
+
+	if (rssi[i] >= 0)
+		return rssi[i];
+	if ((ret = rdpc101_tune_sample(rp, min + i * step, RDPC101_TIMEOUT)) < 0)
+		return ret;
+	(*retunes)++;
+	return rssi[i] = ret;
+}
+
+/*
+ * Scan one rfd entry; returns the number of retunes done.
+ */
+static int hscan_range(struct rdpc101_dev *rp, enum radio_freq_desc_index ind,
+		const struct hscan_opts *opts)
+{
+	int min = rdpc101_freq_min(ind);
+	int step = rdpc101_step(min);
+	int n = (rdpc101_freq_max(ind) - min) / step + 1;
+	int stride = opts->stride;
+	int *rssi, *coarse, *refine;
+	int ncoarse = 0, retunes = 0, peaks = 0;
+	int floor = opts->floor;
+	int ret = 0;
+	int i, j;
+
+	rssi = malloc(n * sizeof *rssi);
+	coarse = malloc(n * sizeof *coarse);
+	refine = calloc(n, sizeof *refine);
+	if (!rssi || !coarse || !refine)
+	{
+		ret = -1;
+		goto out;
+	}
+	for (i = 0; i < n; i++)
+		rssi[i] = -1;
+
+	/* coarse pass, always including the top channel */
+	for (i = 0;; i = (i + stride < n) ? i + stride : n - 1)
+	{
+		if ((ret = hscan_sample(rp, rssi, min, step, i, &retunes)) < 0)
+			goto out;
+		coarse[ncoarse++] = ret;
+		if (i == n - 1)
+			break;
+	}
+	if (floor < 0)
+	{
+		qsort(coarse, ncoarse, sizeof *coarse, cmp_int);
+		floor = coarse[ncoarse / 2] + HSCAN_FLOOR_MARGIN;
+	}
+
+	/* a peak can hide anywhere between a hit and its coarse neighbours */
+	for (i = 0; i < n; i++)
+	{
+		if (rssi[i] < floor)
+			continue;
+		for (j = i - stride + 1; j < i + stride; j++)
+			if (j >= 0 && j < n)
+				refine[j] = TRUE;
+	}
+
+	/* fine pass */
+	for (i = 0; i < n; i++)
+		if (refine[i]
+				&& (ret = hscan_sample(rp, rssi, min, step, i, &retunes)) < 0)
+			goto out;
+
+	for (i = 0; i < n; i++)
+	{
+		char freqstr[FREQSTR_MAX];
+
+		if (!refine[i] || rssi[i] < floor)
+			continue;
+		if ((i > 0 && rssi[i - 1] >= rssi[i])
+				|| (i < n - 1 && rssi[i + 1] > rssi[i]))
+			continue;
+		printf("%s  %3d\n", sstr_freq(freqstr, sizeof freqstr, min + i * step),
+				rssi[i]);
+		peaks++;
+	}
+	Notice("%d-%d: floor %d, %d peaks, %d retunes for %d channels", min,
+			rdpc101_freq_max(ind), floor, peaks, retunes, n);
+	ret = retunes;
+out:
+	free(refine);
+	free(coarse);
+	free(rssi);
+	return ret;
+}
+
+int rdpc101_hscan(struct rdpc101_dev *rp, const struct hscan_opts *opts)
+{
+	int ofreq = rp->cur.freq;
+	enum rdpc_band oband = rdpc101_band(ofreq);
+	enum radio_freq_desc_index ind;
+	int retunes = 0, channels = 0;
+	sigset_t prev_sigs;
+	int ret;
+
+	if (oband != opts->band && (ret = rdpc101_set_band(rp, opts->band)) < 0)
+	{
+		Error("Cannot set band: %x", opts->band);
+		return ret;
+	}
+	prev_sigs = block_sigs();
+	rdpc101_mute(rp, RDPC_MUTE_ON);
+	for (ind = RFD_AM, ret = 0; ind <= RFD_TV && ret >= 0; ind++)
+	{
+		int min = rdpc101_freq_min(ind);
+
+		if (rdpc101_band(min) != opts->band)
+			continue;
+		if ((ret = hscan_range(rp, ind, opts)) < 0)
+		{
+			if (!rdpc101_cancelled())
+				Error("Cannot sample %d-%d", min, rdpc101_freq_max(ind));
+			break;
+		}
+		retunes += ret;
+		channels += (rdpc101_freq_max(ind) - min) / rdpc101_step(min) + 1;
+	}
+	rdpc101_mute(rp, RDPC_MUTE_OFF);
+	unblock_sigs(prev_sigs);
+	if (ret >= 0)
+		printf("%d retunes for %d channels\n", retunes, channels);
+
+	/* nothing to go back to if the state was never read */
+	if (oband >= 0 && ofreq > 0)
+	{
+		if (oband != opts->band && rdpc101_set_band(rp, oband) < 0)
+			Error("Cannot set band: %d", oband);
+		if (rdpc101_set_freq(rp, ofreq) < 0)
+		{
+			char freqstr[FREQSTR_MAX];
+
+			sstr_freq(freqstr, sizeof freqstr, ofreq);
+			Error("Cannot set freq to %s", freqstr);
+		}
+	}
+	return ret < 0 ? ret : 0;
+}
+
+/*-
+ * Copyright (c) 2009 NISHIO Yasuhiro <nishio@hh.iij4u.or.jp>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
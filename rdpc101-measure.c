@@ -0,0 +1,165 @@
+/*
+ * Tune-to-settle latency measurement for SUNTAC RDPC101.
+ *
+ * Retunes across representative channels of each sub-band and reports
+ * how long the tuner takes to show the new frequency (lock) and to
+ * settle on a stable sig_intensity, so scan dwell times can be chosen
+ * from measured values.
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "rdpc101.h"
+#include "rdpc101-cli.h"
+
+#define MEASURE_TIMEOUT_MS	2000
+
+static const struct {
+	const char *name;
+	int freqs[4];
+} measure_set[] =
+{
+	{ "AM", { 594, 954, 1134, 1422 } },
+	{ "FM", { 7650, 8000, 8250, 8900 } },
+	{ "TV", { 9050, 9300, 9500, 10000 } }
+};
+
+#define NMEASURE_SET	(sizeof (measure_set) / sizeof (measure_set[0]))
+#define NMEASURE_FREQS	(sizeof (measure_set[0].freqs) / sizeof (int))
+
+static int cmp_long(const void *a, const void *b)
+{
+	long x = *(const long *) a, y = *(const long *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void print_dist(const char *name, const char *what, long *v, int n,
+		int timeouts)
+{
+	if (n == 0)
+	{
+		printf("%-3s %-6s   n=0 timeouts=%d\n", name, what, timeouts);
+		return;
+	}
+	qsort(v, n, sizeof *v, cmp_long);
+	printf("%-3s %-6s n=%3d min=%6.1f p50=%6.1f p90=%6.1f max=%6.1f ms"
+			" timeouts=%d\n", name, what, n, v[0] / 1000.0,
+			v[n / 2] / 1000.0, v[(n * 9) / 10] / 1000.0, v[n - 1] / 1000.0,
+			timeouts);
+}
+
+int rdpc101_measure_tune(struct rdpc101_dev *rp, int repeat)
+{
+	int ofreq = rp->cur.freq;
+	enum rdpc_band oband = rdpc101_band(ofreq);
+	enum rdpc_band band = oband;
+	long *lock, *settle;
+	int ret = 0;
+	int i;
+
+	lock = malloc(repeat * NMEASURE_FREQS * sizeof *lock);
+	settle = malloc(repeat * NMEASURE_FREQS * sizeof *settle);
+	if (!lock || !settle)
+	{
+		free(lock);
+		free(settle);
+		return -1;
+	}
+
+	for (i = 0; i < NMEASURE_SET && ret >= 0; i++)
+	{
+		enum rdpc_band b = rdpc101_band(measure_set[i].freqs[0]);
+		int nlock = 0, nsettle = 0, timeouts = 0;
+		sigset_t prev_sigs;
+		int r, j;
+
+		if (b != band && (ret = rdpc101_set_band(rp, b)) < 0)
+		{
+			Error("Cannot set band: %x", b);
+			break;
+		}
+		band = b;
+
+		prev_sigs = block_sigs();
+		rdpc101_mute(rp, RDPC_MUTE_ON);
+		for (r = 0; r < repeat && ret >= 0; r++)
+			for (j = 0; j < NMEASURE_FREQS; j++)
+			{
+				struct rdpc101_settle res;
+
+				if ((ret = rdpc101_tune_settle(rp, measure_set[i].freqs[j],
+						RDPC101_SETTLE_TOLERANCE, MEASURE_TIMEOUT_MS, &res)) < 0)
+				{
+					Error("Cannot tune: %d", measure_set[i].freqs[j]);
+					break;
+				}
+				if (res.lock_us >= 0)
+					lock[nlock++] = res.lock_us;
+				if (res.settle_us >= 0)
+					settle[nsettle++] = res.settle_us;
+				else
+					timeouts++;
+				Info("%d: lock %ld us settle %ld us, %d reports, rssi %d",
+						measure_set[i].freqs[j], res.lock_us, res.settle_us,
+						res.reports, res.sig_intensity);
+			}
+		rdpc101_mute(rp, RDPC_MUTE_OFF);
+		unblock_sigs(prev_sigs);
+
+		print_dist(measure_set[i].name, "lock", lock, nlock,
+				repeat * NMEASURE_FREQS - nlock);
+		print_dist(measure_set[i].name, "settle", settle, nsettle, timeouts);
+	}
+
+	/* nothing to go back to if the state was never read */
+	if (oband >= 0 && ofreq > 0)
+	{
+		if (band != oband && rdpc101_set_band(rp, oband) < 0)
+			Error("Cannot set band: %d", oband);
+		if (rdpc101_set_freq(rp, ofreq) < 0)
+		{
+			char freqstr[FREQSTR_MAX];
+
+			sstr_freq(freqstr, sizeof freqstr, ofreq);
+			Error("Cannot set freq to %s", freqstr);
+		}
+	}
+	free(lock);
+	free(settle);
+	return ret < 0 ? ret : 0;
+}
+
+/*-
+ * Copyright (c) 2009 NISHIO Yasuhiro <nishio@hh.iij4u.or.jp>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
@@ -0,0 +1,304 @@
+/*
+ * Priority memory-channel scan for SUNTAC RDPC101.
+ *
+ * Time-slices one tuner across a channel list.  Channels are grouped by
+ * band so each pass switches band at most once per group; inside a
+ * group, smooth weighted round-robin spreads a channel of weight w over
+ * w visits per pass.  Each visit tunes, waits for lock and stays at
+ * least the dwell time.  A channel at or above the squelch level holds
+ * the scan, unmuted, until it drops MEMSCAN_HYSTERESIS below it.  The revisit
+ * interval achieved for every channel is reported at the end.
+ *
+ * Channel list lines:
+ *	freq [weight]
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "rdpc101.h"
+#include "rdpc101-cli.h"
+
+#define MEMSCAN_LINE_MAX	128
+#define MEMSCAN_HYSTERESIS	3
+
+struct mem_chan {
+	int freq;
+	int weight;
+	int current;		/* smooth WRR state */
+	enum rdpc_band band;
+	long visits;
+	long holds;
+	uint64_t last_us;
+	uint64_t sum_us;	/* of revisit intervals */
+	uint64_t max_us;
+};
+
+static int cmp_band(const void *a, const void *b)
+{
+	const struct mem_chan *x = a, *y = b;
+
+	if (x->band != y->band)
+		return x->band < y->band ? -1 : 1;
+	return x->freq - y->freq;
+}
+
+static struct mem_chan *
+memscan_load(const char *path, int expert, int *count)
+{
+	struct mem_chan *ch = NULL, *np;
+	char line[MEMSCAN_LINE_MAX];
+	int n = 0, lineno = 0;
+	FILE *fp;
+
+	if ((fp = fopen(path, "r")) == NULL)
+	{
+		perror(path);
+		return NULL;
+	}
+	while (fgets(line, sizeof line, fp))
+	{
+		char *freqs, *weights;
+		struct mem_chan c;
+
+		lineno++;
+		line[strcspn(line, "#\r\n")] = '\0';
+		if ((freqs = strtok(line, " \t")) == NULL)
+			continue;
+		weights = strtok(NULL, " \t");
+		memset(&c, 0, sizeof c);
+		c.weight = weights ? atoi(weights) : 1;
+		if ((c.freq = parse_freq(freqs, expert, NULL)) <= 0 || c.weight < 1)
+		{
+			Error("%s:%d: syntax error", path, lineno);
+			goto fail;
+		}
+		c.band = rdpc101_band(c.freq);
+		if ((np = realloc(ch, (n + 1) * sizeof *ch)) == NULL)
+		{
+			perror("realloc");
+			goto fail;
+		}
+		ch = np;
+		ch[n++] = c;
+	}
+	fclose(fp);
+	if (n == 0)
+	{
+		Error("%s: no channels", path);
+		free(ch);
+		return NULL;
+	}
+	qsort(ch, n, sizeof *ch, cmp_band);
+	*count = n;
+	return ch;
+fail:
+	fclose(fp);
+	free(ch);
+	return NULL;
+}
+
+/*
+ * Smooth weighted round-robin over ch[0..n): the highest current value
+ * wins and pays back the total weight.
+ */
+static struct mem_chan *memscan_pick(struct mem_chan *ch, int n)
+{
+	struct mem_chan *best = NULL;
+	int total = 0;
+	int i;
+
+	for (i = 0; i < n; i++)
+	{
+		ch[i].current += ch[i].weight;
+		total += ch[i].weight;
+		if (!best || ch[i].current > best->current)
+			best = &ch[i];
+	}
+	best->current -= total;
+	return best;
+}
+
+static void memscan_event(struct mem_chan *c, int rssi, const char *what)
+{
+	char freqstr[FREQSTR_MAX];
+	struct timespec now;
+	char stamp[16];
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	strftime(stamp, sizeof stamp, "%H:%M:%S", localtime(&now.tv_sec));
+	printf("%s.%03ld %10s %3d %s\n", stamp, now.tv_nsec / 1000000,
+			sstr_freq(freqstr, sizeof freqstr, c->freq), rssi, what);
+}
+
+/*
+ * Stay on an active channel until it falls below the release level.
+ */
+static int memscan_hold(struct rdpc101_dev *rp, struct mem_chan *c,
+		const struct memscan_opts *opts)
+{
+	int release = opts->squelch - MEMSCAN_HYSTERESIS;
+	int ret;
+
+	c->holds++;
+	memscan_event(c, rp->cur.sig_intensity, "active");
+	rdpc101_mute(rp, RDPC_MUTE_OFF);
+	while ((ret = rdpc101_read_state(rp, RDPC101_TIMEOUT)) >= 0)
+		if (ret > 0 && rp->cur.sig_intensity < release)
+			break;
+	rdpc101_mute(rp, RDPC_MUTE_ON);
+	if (ret >= 0)
+		memscan_event(c, rp->cur.sig_intensity, "released");
+	return ret;
+}
+
+static int memscan_visit(struct rdpc101_dev *rp, struct mem_chan *c,
+		const struct memscan_opts *opts)
+{
+	uint64_t t0 = rdpc101_now_us();
+	uint64_t dwell_end = t0 + (uint64_t) opts->dwell_ms * 1000;
+	int rssi;
+
+	if (c->last_us)
+	{
+		uint64_t gap = t0 - c->last_us;
+
+		c->sum_us += gap;
+		if (gap > c->max_us)
+			c->max_us = gap;
+	}
+	c->last_us = t0;
+	c->visits++;
+	if ((rssi = rdpc101_tune_sample(rp, c->freq, RDPC101_TIMEOUT)) < 0)
+		return rssi;
+	while (rssi < opts->squelch)
+	{
+		uint64_t now = rdpc101_now_us();
+		int ret;
+
+		if (now >= dwell_end)
+			break;
+		if ((ret = rdpc101_read_state(rp, (dwell_end - now + 999) / 1000)) < 0)
+			return ret;
+		if (ret > 0 && rp->cur.sig_intensity > rssi)
+			rssi = rp->cur.sig_intensity;
+	}
+	if (rssi >= opts->squelch)
+		return memscan_hold(rp, c, opts);
+	return 0;
+}
+
+static void memscan_report(const struct mem_chan *ch, int n)
+{
+	int i;
+
+	printf("%10s %6s %7s %6s %11s %11s\n", "freq", "weight", "visits",
+			"holds", "avg revisit", "max revisit");
+	for (i = 0; i < n; i++)
+	{
+		char freqstr[FREQSTR_MAX];
+		long intervals = ch[i].visits - 1;
+
+		printf("%10s %6d %7ld %6ld %9.1f ms %9.1f ms\n",
+				sstr_freq(freqstr, sizeof freqstr, ch[i].freq), ch[i].weight,
+				ch[i].visits, ch[i].holds,
+				intervals > 0 ? ch[i].sum_us / 1000.0 / intervals : 0.0,
+				ch[i].max_us / 1000.0);
+	}
+}
+
+int rdpc101_memscan(struct rdpc101_dev *rp, const struct memscan_opts *opts)
+{
+	int ofreq = rp->cur.freq;
+	enum rdpc_band oband = rdpc101_band(ofreq);
+	enum rdpc_band band = oband;
+	struct mem_chan *ch;
+	long pass;
+	int n, ret = 0;
+
+	if ((ch = memscan_load(opts->path, opts->expert, &n)) == NULL)
+		return -1;
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	for (pass = 0; (opts->count == 0 || pass < opts->count) && ret >= 0;
+			pass++)
+	{
+		sigset_t prev_sigs = block_sigs();
+		int lo, hi;
+
+		rdpc101_mute(rp, RDPC_MUTE_ON);
+		for (lo = 0; lo < n && ret >= 0; lo = hi)
+		{
+			int picks = 0;
+
+			for (hi = lo; hi < n && ch[hi].band == ch[lo].band; hi++)
+				picks += ch[hi].weight;
+			if (ch[lo].band != band
+					&& (ret = rdpc101_set_band(rp, ch[lo].band)) < 0)
+			{
+				Error("Cannot set band: %x", ch[lo].band);
+				break;
+			}
+			band = ch[lo].band;
+			while (picks-- > 0 && ret >= 0)
+				if ((ret = memscan_visit(rp, memscan_pick(&ch[lo], hi - lo),
+						opts)) < 0 && !rdpc101_cancelled())
+					Error("Cannot tune");
+		}
+		rdpc101_mute(rp, RDPC_MUTE_OFF);
+		unblock_sigs(prev_sigs);
+	}
+
+	memscan_report(ch, n);
+	free(ch);
+	/* nothing to go back to if the state was never read */
+	if (oband >= 0 && ofreq > 0)
+	{
+		if (band != oband && rdpc101_set_band(rp, oband) < 0)
+			Error("Cannot set band: %d", oband);
+		if (rdpc101_set_freq(rp, ofreq) < 0)
+		{
+			char freqstr[FREQSTR_MAX];
+
+			sstr_freq(freqstr, sizeof freqstr, ofreq);
+			Error("Cannot set freq to %s", freqstr);
+		}
+	}
+	return ret < 0 ? ret : 0;
+}
+
+/*-
+ * Copyright (c) 2009 NISHIO Yasuhiro <nishio@hh.iij4u.or.jp>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
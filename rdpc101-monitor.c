@@ -0,0 +1,353 @@
+/*
+ * Long-term reception monitor for SUNTAC RDPC101.
+ *
+ * Every decoded status report updates a fixed-size sketch for its
+ * (serial, freq) pair: a 256-bin sig_intensity histogram (the value is
+ * one byte, so quantiles are exact), an EWMA, min/max and runs of
+ * samples below the dropout level.  A station costs the same however
+ * long the monitor runs.  The sketches are written to a checkpoint file
+ * every interval (temporary file, fsync, rename) and read back on the
+ * next start.
+ *
+ * Checkpoint lines:
+ *	serial freq samples min max ewma dropouts run longest first last
+ *		p10 p50 p90 | value:count...
+ */
+
+#include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "rdpc101.h"
+#include "rdpc101-cli.h"
+
+#define MON_BINS		256
+#define MON_EWMA_SHIFT		4	/* alpha = 1/16 */
+#define MON_POLL_MS		50
+#define MON_LINE_MAX		(MON_BINS * 16)
+
+struct mon_station {
+	char serial[RDPC101_SERIAL_MAX];
+	int freq;
+	uint64_t samples;
+	int min, max;
+	long ewma;		/* sig_intensity << MON_EWMA_SHIFT */
+	uint64_t dropouts;	/* runs below the dropout level */
+	uint32_t run;		/* current run, samples */
+	uint32_t longest;
+	time_t first, last;
+	uint32_t hist[MON_BINS];
+};
+
+struct monitor {
+	struct mon_station *st;
+	int nst;
+	int *last;		/* per device index, station last updated */
+	int ndev;
+	int dropout;
+	const char *path;
+};
+
+static void dev_serial(struct rdpc101_dev *rp, char *buf, int size)
+{
+	if (rp->dev && rp->dev->serial_number && *rp->dev->serial_number)
+		snprintf(buf, size, "%ls", rp->dev->serial_number);
+	else
+		snprintf(buf, size, "#%d", rp->index);
+}
+
+static struct mon_station *
+mon_find(struct monitor *m, const char *serial, int freq)
+{
+	struct mon_station *np;
+	int i;
+
+	for (i = 0; i < m->nst; i++)
+		if (m->st[i].freq == freq && strcmp(m->st[i].serial, serial) == 0)
+			return &m->st[i];
+	if ((np = realloc(m->st, (m->nst + 1) * sizeof *np)) == NULL)
+		return NULL;
+	m->st = np;
+	np = &m->st[m->nst++];
+	memset(np, 0, sizeof *np);
+	snprintf(np->serial, sizeof np->serial, "%s", serial);
+	np->freq = freq;
+	np->min = MON_BINS;
+	np->max = -1;
+	return np;
+}
+
+static int mon_quantile(const struct mon_station *s, int pct)
+{
+	uint64_t want = (s->samples * pct + 99) / 100, sum = 0;
+	int v;
+
+	for (v = 0; v < MON_BINS; v++)
+		if ((sum += s->hist[v]) >= want && sum > 0)
+			return v;
+	return -1;
+}
+
+static void mon_update(struct rdpc101_dev *rp, void *arg)
+{
+	struct monitor *m = arg;
+	struct mon_station *s = NULL;
+	int v = rp->cur.sig_intensity & (MON_BINS - 1);
+
+	if (rp->cur.ma & RDPC_MA_SEEKING_MASK)
+		return;
+	if (rp->index < m->ndev && m->last[rp->index] >= 0)
+	{
+		s = &m->st[m->last[rp->index]];
+		if (s->freq != rp->cur.freq)
+			s = NULL;
+	}
+	if (s == NULL)
+	{
+		char serial[RDPC101_SERIAL_MAX];
+
+		dev_serial(rp, serial, sizeof serial);
+		if ((s = mon_find(m, serial, rp->cur.freq)) == NULL)
+			return;
+		if (rp->index < m->ndev)
+			m->last[rp->index] = s - m->st;
+	}
+
+	s->last = time(NULL);
+	if (s->samples++ == 0)
+	{
+		s->first = s->last;
+		s->ewma = (long) v << MON_EWMA_SHIFT;
+	}
+	else
+		s->ewma += v - (s->ewma >> MON_EWMA_SHIFT);
+	s->hist[v]++;
+	if (v < s->min)
+		s->min = v;
+	if (v > s->max)
+		s->max = v;
+	if (v < m->dropout)
+	{
+		if (s->run++ == 0)
+			s->dropouts++;
+		if (s->run > s->longest)
+			s->longest = s->run;
+	}
+	else
+		s->run = 0;
+}
+
+static int mon_checkpoint(struct monitor *m)
+{
+	char tmp[FILENAME_MAX];
+	FILE *fp;
+	int i, v;
+	int fd;
+
+	snprintf(tmp, sizeof tmp, "%s.tmp", m->path);
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0
+			|| (fp = fdopen(fd, "w")) == NULL)
+	{
+		perror(tmp);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	for (i = 0; i < m->nst; i++)
+	{
+		const struct mon_station *s = &m->st[i];
+
+		fprintf(fp, "%s %d %llu %d %d %.2f %llu %u %u %ld %ld %d %d %d |",
+				s->serial, s->freq, (unsigned long long) s->samples,
+				s->min, s->max, s->ewma / (double) (1 << MON_EWMA_SHIFT),
+				(unsigned long long) s->dropouts, s->run, s->longest,
+				(long) s->first, (long) s->last, mon_quantile(s, 10),
+				mon_quantile(s, 50), mon_quantile(s, 90));
+		for (v = 0; v < MON_BINS; v++)
+			if (s->hist[v])
+				fprintf(fp, " %d:%u", v, s->hist[v]);
+		fputc('\n', fp);
+	}
+	if (fflush(fp) != 0 || fsync(fd) < 0)
+	{
+		perror(tmp);
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+	if (rename(tmp, m->path) < 0)
+	{
+		perror(m->path);
+		return -1;
+	}
+	return 0;
+}
+
+static int mon_load(struct monitor *m)
+{
+	char *line;
+	FILE *fp;
+	int lineno = 0;
+
+	if ((fp = fopen(m->path, "r")) == NULL)
+		return errno == ENOENT ? 0 : -1;
+	if ((line = malloc(MON_LINE_MAX)) == NULL)
+	{
+		fclose(fp);
+		return -1;
+	}
+	while (fgets(line, MON_LINE_MAX, fp))
+	{
+		char serial[RDPC101_SERIAL_MAX];
+		unsigned long long samples, dropouts;
+		struct mon_station *s;
+		unsigned run, longest;
+		long first, last;
+		int freq, min, max;
+		double ewma;
+		char *p;
+
+		lineno++;
+		if (sscanf(line, "%63s %d %llu %d %d %lf %llu %u %u %ld %ld", serial,
+				&freq, &samples, &min, &max, &ewma, &dropouts, &run, &longest,
+				&first, &last) != 11 || (p = strchr(line, '|')) == NULL)
+		{
+			Warn("%s:%d: ignored", m->path, lineno);
+			continue;
+		}
+		if ((s = mon_find(m, serial, freq)) == NULL)
+			break;
+		s->samples = samples;
+		s->min = min;
+		s->max = max;
+		s->ewma = ewma * (1 << MON_EWMA_SHIFT);
+		s->dropouts = dropouts;
+		s->run = run;
+		s->longest = longest;
+		s->first = first;
+		s->last = last;
+		for (p++; *p;)
+		{
+			unsigned v, count;
+			int n;
+
+			if (sscanf(p, " %u:%u%n", &v, &count, &n) != 2)
+				break;
+			if (v < MON_BINS)
+				s->hist[v] = count;
+			p += n;
+		}
+	}
+	free(line);
+	fclose(fp);
+	Notice("%s: %d stations restored", m->path, m->nst);
+	return 0;
+}
+
+/*
+ * Monitor every device until interrupted.  Devices on the hidraw
+ * backend are served by the reactor, otherwise each is read in turn.
+ */
+int rdpc101_monitor(struct rdpc101_dev *list, const char *path, int interval,
+		int dropout)
+{
+	struct rdpc101_reactor *r = NULL;
+	struct monitor m;
+	struct rdpc101_dev *p;
+	uint64_t next;
+	int ret = 0;
+	int i;
+
+	memset(&m, 0, sizeof m);
+	m.path = path;
+	m.dropout = dropout;
+	for (p = list; p; p = p->next)
+		m.ndev = p->index + 1;
+	if ((m.last = malloc(m.ndev * sizeof *m.last)) == NULL)
+		return -1;
+	for (i = 0; i < m.ndev; i++)
+		m.last[i] = -1;
+	if (mon_load(&m) < 0)
+	{
+		perror(path);
+		free(m.last);
+		return -1;
+	}
+	if (rdpc101_add_state_hook(mon_update, &m) < 0)
+	{
+		Error("Cannot hook status reports");
+		free(m.last);
+		return -1;
+	}
+
+	if (rdpc101_fileno(list) >= 0 && (r = rdpc101_reactor_new(NULL, NULL)))
+		for (p = list; p; p = p->next)
+			if (rdpc101_reactor_add(r, p) < 0)
+			{
+				Error("Cannot monitor dev %d", p->index);
+				ret = -1;
+				goto out;
+			}
+
+	next = rdpc101_now_us() + (uint64_t) interval * 1000000;
+	for (;;)
+	{
+		if (r)
+			ret = rdpc101_reactor_run(r, interval * 1000);
+		else
+			for (p = list; p && ret >= 0; p = p->next)
+				ret = rdpc101_read_state(p, MON_POLL_MS);
+		if (ret < 0)
+			break;
+		if (rdpc101_now_us() >= next)
+		{
+			mon_checkpoint(&m);
+			next += (uint64_t) interval * 1000000;
+		}
+	}
+out:
+	rdpc101_del_state_hook(mon_update, &m);
+	mon_checkpoint(&m);
+	rdpc101_reactor_free(r);
+	free(m.st);
+	free(m.last);
+	return ret;
+}
+
+/*-
+ * Copyright (c) 2009 NISHIO Yasuhiro <nishio@hh.iij4u.or.jp>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
@@ -0,0 +1,333 @@
+/*
+ * Timetable driven retuning for SUNTAC RDPC101.
+ *
+ * Loads a timetable, keeps every device handle open, builds the feature
+ * reports up front and sends them when a timerfd armed on the absolute
+ * CLOCK_REALTIME deadline fires.  Each change is logged with how far
+ * from the scheduled instant the reports actually went out.
+ *
+ * Timetable lines:
+ *	HH:MM[:SS]            serial freq [stereo|mono]	(every day)
+ *	YYYY-MM-DDTHH:MM[:SS] serial freq [stereo|mono]	(once)
+ * serial is a device serial number or #index.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+#include <sys/types.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(HAVE_SYS_TIMERFD_H)
+#include <sys/timerfd.h>
+#endif
+#include "rdpc101.h"
+#include "rdpc101-cli.h"
+
+#define SCHED_LINE_MAX	256
+
+struct sched_entry {
+	time_t due;		/* 0 once a one-shot entry has fired */
+	int daily;		/* seconds after midnight, -1 for one-shot */
+	struct rdpc101_dev *rp;
+	int freq;
+	enum rdpc_ma ma;
+	unsigned char band_report[RDPC101_REPORT_SIZE];
+	unsigned char freq_report[RDPC101_REPORT_SIZE];
+	unsigned char ma_report[RDPC101_REPORT_SIZE];
+	char serial[RDPC101_SERIAL_MAX];
+};
+
+static time_t sched_next_daily(int daily, time_t after)
+{
+	struct tm tm;
+	time_t t;
+
+	localtime_r(&after, &tm);
+	tm.tm_hour = daily / 3600;
+	tm.tm_min = daily / 60 % 60;
+	tm.tm_sec = daily % 60;
+	tm.tm_isdst = -1;
+	if ((t = mktime(&tm)) <= after)
+	{
+		tm.tm_mday++;
+		tm.tm_hour = daily / 3600;
+		tm.tm_min = daily / 60 % 60;
+		tm.tm_sec = daily % 60;
+		tm.tm_isdst = -1;
+		t = mktime(&tm);
+	}
+	return t;
+}
+
+static int sched_parse_time(const char *s, struct sched_entry *e, time_t now)
+{
+	struct tm tm;
+	int h, m, sec = 0;
+
+	memset(&tm, 0, sizeof tm);
+	if (strchr(s, 'T'))
+	{
+		if (sscanf(s, "%d-%d-%dT%d:%d:%d", &tm.tm_year, &tm.tm_mon,
+				&tm.tm_mday, &h, &m, &sec) < 5)
+			return -1;
+		tm.tm_year -= 1900;
+		tm.tm_mon -= 1;
+		tm.tm_hour = h;
+		tm.tm_min = m;
+		tm.tm_sec = sec;
+		tm.tm_isdst = -1;
+		e->daily = -1;
+		e->due = mktime(&tm);
+		return e->due == (time_t) -1 ? -1 : 0;
+	}
+	if (sscanf(s, "%d:%d:%d", &h, &m, &sec) < 2 || h < 0 || h > 23 || m < 0
+			|| m > 59 || sec < 0 || sec > 59)
+		return -1;
+	e->daily = h * 3600 + m * 60 + sec;
+	e->due = sched_next_daily(e->daily, now);
+	return 0;
+}
+
+static struct sched_entry *
+sched_load(const char *path, struct rdpc101_dev *list, int expert, int *count)
+{
+	struct sched_entry *ent = NULL;
+	char line[SCHED_LINE_MAX];
+	time_t now = time(NULL);
+	int n = 0, lineno = 0;
+	FILE *fp;
+
+	if ((fp = fopen(path, "r")) == NULL)
+	{
+		perror(path);
+		return NULL;
+	}
+	while (fgets(line, sizeof line, fp))
+	{
+		char *when, *serial, *freqs, *mas;
+		struct sched_entry e, *np;
+
+		lineno++;
+		line[strcspn(line, "\r\n")] = '\0';
+		if ((when = strtok(line, " \t")) == NULL || *when == '#')
+			continue;
+		serial = strtok(NULL, " \t");
+		freqs = strtok(NULL, " \t");
+		mas = strtok(NULL, " \t");
+		memset(&e, 0, sizeof e);
+		e.ma = RDPC_MA_UNSPEC;
+		if (!serial || !freqs || sched_parse_time(when, &e, now) < 0
+				|| (e.freq = parse_freq(freqs, expert, &e.ma)) <= 0)
+		{
+			Error("%s:%d: syntax error", path, lineno);
+			goto fail;
+		}
+		if (mas && strcasecmp(mas, "stereo") == 0)
+			e.ma = RDPC_MA_STEREO;
+		else if (mas && strcasecmp(mas, "mono") == 0)
+			e.ma = RDPC_MA_MONO;
+		if (*serial == '#' && isdigit(serial[1]))
+			e.rp = rdpc101_device(list, atoi(serial + 1));
+		else
+			e.rp = rdpc101_device_by_serial(list, serial);
+		if (!e.rp)
+		{
+			Error("%s:%d: no such device: %s", path, lineno, serial);
+			goto fail;
+		}
+		if (e.daily < 0 && e.due <= now)
+		{
+			Warn("%s:%d: %s is in the past, skipped", path, lineno, when);
+			continue;
+		}
+		snprintf(e.serial, sizeof e.serial, "%ls",
+				e.rp->dev->serial_number ? e.rp->dev->serial_number : L"-");
+		rdpc101_build_report(e.band_report, RDPC_BAND, rdpc101_band(e.freq));
+		rdpc101_build_report(e.freq_report, RDPC_SETFREQ, e.freq);
+		rdpc101_build_report(e.ma_report, RDPC_MA, e.ma);
+
+		if ((np = realloc(ent, (n + 1) * sizeof *ent)) == NULL)
+		{
+			perror("realloc");
+			goto fail;
+		}
+		ent = np;
+		ent[n++] = e;
+	}
+	fclose(fp);
+	if (n == 0)
+		Error("%s: no entries to schedule", path);
+	*count = n;
+	return ent;
+fail:
+	fclose(fp);
+	free(ent);
+	return NULL;
+}
+
+static long ts_diff_us(const struct timespec *a, time_t b)
+{
+	return (a->tv_sec - b) * 1000000L + a->tv_nsec / 1000;
+}
+
+/*
+ * Send the prebuilt reports.  No status is read on this path, so cur
+ * is kept at the commanded values to decide on later band switches.
+ */
+static int sched_fire(struct sched_entry *e)
+{
+	struct rdpc101_dev *rp = e->rp;
+	int ret;
+
+	if (rdpc101_band(rp->cur.freq) != rdpc101_band(e->freq))
+	{
+		if ((ret = rdpc101_set_report(rp, e->band_report,
+				sizeof e->band_report)) < 0)
+			return ret;
+	}
+	if ((ret = rdpc101_set_report(rp, e->freq_report,
+			sizeof e->freq_report)) < 0)
+		return ret;
+	rp->cur.freq = e->freq;
+	if (e->ma != RDPC_MA_UNSPEC && e->ma != (rp->cur.ma & ~RDPC_MA_SEEKING_MASK))
+	{
+		if ((ret = rdpc101_set_report(rp, e->ma_report,
+				sizeof e->ma_report)) < 0)
+			return ret;
+		rp->cur.ma = e->ma;
+	}
+	return 0;
+}
+
+#if defined(HAVE_SYS_TIMERFD_H)
+int rdpc101_schedule(struct rdpc101_dev *list, const char *path, int expert)
+{
+	struct sched_entry *ent;
+	int n, i;
+	int tfd;
+	int ret = 0;
+
+	if ((ent = sched_load(path, list, expert, &n)) == NULL)
+		return -1;
+	/* open and stat every device now, not at the first deadline */
+	for (i = 0; i < n; i++)
+		if (ent[i].rp->cur.ma == RDPC_MA_UNSPEC
+				&& rdpc101_update_state(ent[i].rp) < 0)
+		{
+			Error("Cannot stat dev: %s", ent[i].serial);
+			free(ent);
+			return -1;
+		}
+	if ((tfd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC)) < 0)
+	{
+		perror("timerfd_create");
+		free(ent);
+		return -1;
+	}
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	for (;;)
+	{
+		struct itimerspec its;
+		time_t due = 0;
+		uint64_t expirations;
+
+		for (i = 0; i < n; i++)
+			if (ent[i].due && (due == 0 || ent[i].due < due))
+				due = ent[i].due;
+		if (due == 0)
+			break;
+
+		memset(&its, 0, sizeof its);
+		its.it_value.tv_sec = due;
+		if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+		{
+			perror("timerfd_settime");
+			ret = -1;
+			break;
+		}
+		if (read(tfd, &expirations, sizeof expirations) < 0)
+		{
+			if (errno == EINTR && !rdpc101_cancelled())
+				continue;
+			if (errno != EINTR)
+				perror("read timerfd");
+			ret = -1;
+			break;
+		}
+
+		for (i = 0; i < n; i++)
+		{
+			struct sched_entry *e = &ent[i];
+			struct timespec wake, done;
+			char stamp[32], freqstr[FREQSTR_MAX];
+			int r;
+
+			if (e->due != due)
+				continue;
+			clock_gettime(CLOCK_REALTIME, &wake);
+			r = sched_fire(e);
+			clock_gettime(CLOCK_REALTIME, &done);
+
+			strftime(stamp, sizeof stamp, "%Y-%m-%d %H:%M:%S",
+					localtime(&due));
+			printf("%s %s %s %s %s wake %+ld us done %+ld us\n", stamp,
+					e->serial, sstr_freq(freqstr, sizeof freqstr, e->freq),
+					str_ma(e->ma), r < 0 ? "failed" : "ok",
+					ts_diff_us(&wake, due), ts_diff_us(&done, due));
+
+			e->due = e->daily < 0 ? 0 : sched_next_daily(e->daily, due);
+		}
+	}
+	close(tfd);
+	free(ent);
+	return ret;
+}
+#else
+int rdpc101_schedule(struct rdpc101_dev *list, const char *path, int expert)
+{
+	Error("--schedule requires timerfd, not available on this system");
+	return -1;
+}
+#endif
+
+/*-
+ * Copyright (c) 2009 NISHIO Yasuhiro <nishio@hh.iij4u.or.jp>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
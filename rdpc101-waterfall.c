@@ -0,0 +1,286 @@
+/*
+ * Spectrum waterfall for SUNTAC RDPC101.
+ *
+ * Sweeps a frequency range over and over and writes only the cells
+ * whose (peak-held) RSSI moved by more than a threshold since they were
+ * last written, so a quiet band produces almost no output.  All buffers
+ * are sized from the range once; memory does not grow with run time.
+ * A cell that does not lock within a few dwell times is marked missing
+ * rather than holding up the sweep.
+ *
+ * Binary stream (little endian):
+ *   header: "RDWF" u8 version, u16 freq_min, u16 step, u16 ncells
+ *   frame:  u32 sweep, u32 msec, u16 n, n * { u16 cell, u8 rssi }
+ * rssi is WF_MISSING for a cell that did not lock.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "rdpc101.h"
+#include "rdpc101-cli.h"
+
+#define WF_VERSION	2
+#define WF_MISSING	0xff
+#define WF_LOCK_DWELLS	4	/* lock wait, in dwell times */
+#define WF_LOCK_MIN_MS	20
+#define WF_RSSI_FULLSCALE	64
+#define WF_ANSI_GRAY_BASE	232
+#define WF_ANSI_GRAY_LEVELS	24
+
+static void put_u16(uint8_t *p, unsigned v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+}
+
+static void put_u32(uint8_t *p, unsigned long v)
+{
+	put_u16(p, v & 0xffff);
+	put_u16(p + 2, (v >> 16) & 0xffff);
+}
+
+static unsigned long elapsed_ms(const struct timespec *t0)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (t.tv_sec - t0->tv_sec) * 1000
+			+ (t.tv_nsec - t0->tv_nsec) / 1000000;
+}
+
+static void emit_header(const struct waterfall_opts *opts, int ncells)
+{
+	uint8_t hdr[11];
+
+	memcpy(hdr, "RDWF", 4);
+	hdr[4] = WF_VERSION;
+	put_u16(hdr + 5, opts->freq_min);
+	put_u16(hdr + 7, opts->step);
+	put_u16(hdr + 9, ncells);
+	fwrite(hdr, sizeof hdr, 1, stdout);
+}
+
+static void emit_binary(long sweep, unsigned long msec, const uint8_t *row,
+		const uint16_t *changed, int nchanged)
+{
+	uint8_t rec[10];
+	int i;
+
+	put_u32(rec, sweep);
+	put_u32(rec + 4, msec);
+	put_u16(rec + 8, nchanged);
+	fwrite(rec, sizeof rec, 1, stdout);
+	for (i = 0; i < nchanged; i++)
+	{
+		put_u16(rec, changed[i]);
+		rec[2] = row[changed[i]];
+		fwrite(rec, 3, 1, stdout);
+	}
+}
+
+static void emit_ansi(const uint8_t *row, int ncells, const uint16_t *changed,
+		int nchanged)
+{
+	char stamp[16];
+	time_t now = time(NULL);
+	int i, j;
+
+	strftime(stamp, sizeof stamp, "%H:%M:%S", localtime(&now));
+	printf("%s ", stamp);
+	for (i = 0, j = 0; i < ncells; i++)
+	{
+		int level;
+
+		if (j >= nchanged || changed[j] != i)
+		{
+			putchar(' ');
+			continue;
+		}
+		j++;
+		if (row[i] == WF_MISSING)
+		{
+			putchar('?');
+			continue;
+		}
+		level = row[i] >= WF_RSSI_FULLSCALE ? WF_ANSI_GRAY_LEVELS - 1
+				: row[i] * WF_ANSI_GRAY_LEVELS / WF_RSSI_FULLSCALE;
+		printf("\033[48;5;%dm \033[0m", WF_ANSI_GRAY_BASE + level);
+	}
+	putchar('\n');
+}
+
+/*
+ * Like rdpc101_tune_sample(), but within timeout_ms in all.  Returns
+ * the RSSI, WF_MISSING if the tuner did not show freq in time, or <0.
+ */
+static int wf_sample(struct rdpc101_dev *rp, int freq, int timeout_ms)
+{
+	uint64_t deadline = rdpc101_now_us() + (uint64_t) timeout_ms * 1000;
+	int locked = FALSE;
+	int ret;
+
+	if ((ret = rdpc101_set_freq(rp, freq)) < 0)
+		return ret;
+	for (;;)
+	{
+		uint64_t now = rdpc101_now_us();
+
+		if (now >= deadline)
+			return WF_MISSING;
+		if ((ret = rdpc101_read_state(rp, (deadline - now + 999) / 1000)) < 0)
+			return ret;
+		if (ret == 0 || rp->cur.freq != freq)
+			continue;
+		/* one more report so sig_intensity is the new channel's */
+		if (locked)
+			return rp->cur.sig_intensity >= WF_MISSING ? WF_MISSING - 1
+					: rp->cur.sig_intensity;
+		locked = TRUE;
+	}
+}
+
+int rdpc101_waterfall(struct rdpc101_dev *rp, const struct waterfall_opts *opts)
+{
+	int ncells = (opts->freq_max - opts->freq_min) / opts->step + 1;
+	int ofreq = rp->cur.freq;
+	enum rdpc_band oband = rdpc101_band(ofreq);
+	enum rdpc_band band = rdpc101_band(opts->freq_min);
+	int lock_ms = opts->dwell_ms * WF_LOCK_DWELLS;
+	uint8_t *ring, *shown, *peak;
+	uint16_t *changed;
+	struct timespec t0;
+	long sweep;
+	int ret = 0;
+
+	ring = calloc(opts->depth, ncells);
+	shown = malloc(ncells);
+	peak = malloc(ncells);
+	changed = malloc(ncells * sizeof *changed);
+	if (!ring || !shown || !peak || !changed)
+	{
+		Error("Cannot allocate %d cells", ncells);
+		ret = -1;
+		goto out;
+	}
+
+	if (oband != band && (ret = rdpc101_set_band(rp, band)) < 0)
+	{
+		Error("Cannot set band: %x", band);
+		goto out;
+	}
+	if (lock_ms < WF_LOCK_MIN_MS)
+		lock_ms = WF_LOCK_MIN_MS;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if (opts->format == WATERFALL_BINARY)
+		emit_header(opts, ncells);
+
+	for (sweep = 0; opts->count == 0 || sweep < opts->count; sweep++)
+	{
+		uint8_t *row = ring + (sweep % opts->depth) * ncells;
+		int held = sweep + 1 < opts->depth ? sweep + 1 : opts->depth;
+		int nchanged = 0;
+		sigset_t prev_sigs = block_sigs();
+		int i, k;
+
+		rdpc101_mute(rp, RDPC_MUTE_ON);
+		for (i = 0; i < ncells; i++)
+		{
+			if ((ret = wf_sample(rp, opts->freq_min + i * opts->step,
+					lock_ms)) < 0)
+				break;
+			row[i] = ret;
+		}
+		rdpc101_mute(rp, RDPC_MUTE_OFF);
+		unblock_sigs(prev_sigs);
+		if (ret < 0)
+		{
+			char freqstr[FREQSTR_MAX];
+
+			if (rdpc101_cancelled())
+				break;
+			sstr_freq(freqstr, sizeof freqstr, opts->freq_min + i * opts->step);
+			Error("Cannot sample %s", freqstr);
+			break;
+		}
+		ret = 0;
+
+		for (i = 0; i < ncells; i++)
+		{
+			peak[i] = WF_MISSING;
+			for (k = 0; k < held; k++)
+				if (ring[k * ncells + i] != WF_MISSING
+						&& (peak[i] == WF_MISSING
+						|| ring[k * ncells + i] > peak[i]))
+					peak[i] = ring[k * ncells + i];
+			if (sweep == 0 || abs(peak[i] - shown[i]) > opts->threshold)
+			{
+				shown[i] = peak[i];
+				changed[nchanged++] = i;
+			}
+		}
+		if (nchanged == 0)
+			continue;
+		if (opts->format == WATERFALL_BINARY)
+			emit_binary(sweep, elapsed_ms(&t0), peak, changed, nchanged);
+		else
+			emit_ansi(peak, ncells, changed, nchanged);
+		fflush(stdout);
+	}
+
+	/* nothing to go back to if the state was never read */
+	if (oband < 0 || ofreq <= 0)
+		goto out;
+	if (oband != band && rdpc101_set_band(rp, oband) < 0)
+		Error("Cannot set band: %d", oband);
+	if (rdpc101_set_freq(rp, ofreq) < 0)
+	{
+		char freqstr[FREQSTR_MAX];
+
+		sstr_freq(freqstr, sizeof freqstr, ofreq);
+		Error("Cannot set freq to %s", freqstr);
+	}
+out:
+	free(changed);
+	free(peak);
+	free(shown);
+	free(ring);
+	return ret;
+}
+
+/*-
+ * Copyright (c) 2009 NISHIO Yasuhiro <nishio@hh.iij4u.or.jp>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
@@ -14,75 +14,83 @@
 #include <ctype.h>
 #include <err.h>
 #include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 #include <unistd.h>
 #include "rdpc101.h"
-
-#define ISTRING_MAX	512
-#define FREQ_MAX_WIDTH_STR	"108.00 MHz"
-#define FREQ_MAX_WIDTH	(sizeof (FREQ_MAX_WIDTH_STR) - 1)
-#define FREQSTR_MAX	((FREQ_MAX_WIDTH + 1 + sizeof (int) - 1) & ~(sizeof (int) - 1))
-
-/*
- * Utils
- */
-#if !defined(Info)
-#define Info(fmt, arg...)						\
-    do {								\
-	if (flag_verbose > 1)						\
-	    fprintf(stderr, __FILE__ "(%d): " fmt "\n", __LINE__, ## arg); \
-    } while (0)
-
-#define Info_packet(label, buf, size)					\
-    do {								\
-	if (flag_verbose > 1)						\
-	    dump_packet(label, buf, size);				\
-    } while (0)
-#define Notice(fmt, arg...)						\
-    do {								\
-	if (flag_verbose > 0)						\
-	    fprintf(stderr, __FILE__ "(%d): " fmt "\n", __LINE__, ## arg); \
-    } while (0)
-#define Warn(fmt, arg...)						\
-    do {								\
-	fprintf(stderr, __FILE__ "(%d): " fmt "\n", __LINE__, ## arg);	\
-    } while (0)
-
-#define Error(fmt, arg...)						\
-    do {								\
-	fprintf(stderr, __FILE__ "(%d): " fmt "\n", __LINE__, ## arg);	\
-    } while (0)
-
-#if defined(DEBUG)
-#define Debug(fmt, arg...)						\
-    do {								\
-	fprintf(stderr, __FILE__ "(%d): " fmt "\n", __LINE__, ## arg);	\
-    } while (0)
-#else
-#define Debug(fmt, arg...) do {} while (0)
-#endif
-#endif
-
-struct dev_info *get_dev_info(void);
-void rdpc101_list_device(struct rdpc101_dev *rp);
-char *sstr_freq(char *buf, int size, int freq);
-int rdpc101_scan(struct rdpc101_dev *rp, enum rdpc_band band);
-void set_signal_handlers(void);
-sigset_t block_sigs();
-void unblock_sigs(sigset_t sigs);
-void display_freq(struct rdpc101_dev *rp);
-void rdpc101_display_seeking(struct rdpc101_dev *rp);
-int rdpc101_scan(struct rdpc101_dev *rp, enum rdpc_band band);
+#include "rdpc101-cli.h"
 
 __RCSID("$Id: rdpc101.c,v 1.3 2009/07/07 13:33:53 nishio Exp $");
 
-int flag_verbose = 0;
 const char *program_name;
 
+enum long_option_id {
+	OPT_WATERFALL = 0x100,
+	OPT_WF_STEP,
+	OPT_WF_THRESHOLD,
+	OPT_WF_DEPTH,
+	OPT_WF_COUNT,
+	OPT_WF_BINARY,
+	OPT_MEASURE_TUNE,
+	OPT_WATCH,
+	OPT_SCHEDULE,
+	OPT_WATCH_ALL,
+	OPT_COARSE_SCAN,
+	OPT_STRIDE,
+	OPT_FLOOR,
+	OPT_MONITOR,
+	OPT_INTERVAL,
+	OPT_DROPOUT,
+	OPT_RECORDER,
+	OPT_MEMSCAN,
+	OPT_DWELL,
+	OPT_SQUELCH,
+	OPT_RT,
+	OPT_CPUS,
+	OPT_POLL,
+	OPT_ALARMS,
+	OPT_ALARM_HOOK,
+	OPT_ARCHIVE
+};
+
+static const struct option long_options[] =
+{
+	{ "waterfall", required_argument, NULL, OPT_WATERFALL },
+	{ "step", required_argument, NULL, OPT_WF_STEP },
+	{ "threshold", required_argument, NULL, OPT_WF_THRESHOLD },
+	{ "depth", required_argument, NULL, OPT_WF_DEPTH },
+	{ "count", required_argument, NULL, OPT_WF_COUNT },
+	{ "binary", no_argument, NULL, OPT_WF_BINARY },
+	{ "measure-tune", optional_argument, NULL, OPT_MEASURE_TUNE },
+	{ "watch", optional_argument, NULL, OPT_WATCH },
+	{ "schedule", required_argument, NULL, OPT_SCHEDULE },
+	{ "watch-all", optional_argument, NULL, OPT_WATCH_ALL },
+	{ "coarse-scan", required_argument, NULL, OPT_COARSE_SCAN },
+	{ "stride", required_argument, NULL, OPT_STRIDE },
+	{ "floor", required_argument, NULL, OPT_FLOOR },
+	{ "monitor", required_argument, NULL, OPT_MONITOR },
+	{ "interval", required_argument, NULL, OPT_INTERVAL },
+	{ "dropout", required_argument, NULL, OPT_DROPOUT },
+	{ "recorder", required_argument, NULL, OPT_RECORDER },
+	{ "memscan", required_argument, NULL, OPT_MEMSCAN },
+	{ "dwell", required_argument, NULL, OPT_DWELL },
+	{ "squelch", required_argument, NULL, OPT_SQUELCH },
+	{ "rt", optional_argument, NULL, OPT_RT },
+	{ "cpus", required_argument, NULL, OPT_CPUS },
+	{ "poll", required_argument, NULL, OPT_POLL },
+	{ "alarms", required_argument, NULL, OPT_ALARMS },
+	{ "alarm-hook", required_argument, NULL, OPT_ALARM_HOOK },
+	{ "archive", required_argument, NULL, OPT_ARCHIVE },
+	{ "hidraw", no_argument, NULL, 'H' },
+	{ NULL, 0, NULL, 0 }
+};
+
 int main(int argc, char **argv)
 {
 	int c;
@@ -94,6 +102,28 @@ int main(int argc, char **argv)
 	enum rdpc_band flag_scan = RDPC_BAND_UNSPEC;
 	enum rdpc_ma flag_ma = RDPC_MA_UNSPEC;
 	enum rdpc_seek flag_seek = RDPC_SEEK_UNSPEC;
+	const char *waterfall_range = NULL;
+	const char *batch_file = NULL;
+	const char *schedule_file = NULL;
+	const char *monitor_file = NULL;
+	int monitor_interval = 60;
+	int monitor_dropout = 10;
+	const char *alarm_file = NULL;
+	const char *alarm_hook = NULL;
+	int measure_repeat = 0;
+	int flag_watch = 0;
+	int flag_watch_all = 0;
+	int watch_deadband = 2;
+	long poll_us = 0;
+	int flag_rt = 0;
+	struct rdpc101_rt rt =
+	{ 0, 0, FALSE };
+	struct waterfall_opts wf =
+	{ 0, 0, 0, 3, 4, 0, WATERFALL_ANSI, 50 };
+	struct hscan_opts hs =
+	{ RDPC_BAND_UNSPEC, 4, -1 };
+	struct memscan_opts ms =
+	{ NULL, 0, 50, 30, 0 };
 	struct dev_info *dev_info;
 	struct rdpc101_dev *rdpc101_list;
 	struct rdpc101_dev *rp;
@@ -102,9 +132,169 @@ int main(int argc, char **argv)
 
 	program_name = argv[0];
 	opterr = 0;
-	while ((c = getopt(argc, argv, "Dd:lmsS:vUx")) != -1)
+	while ((c = getopt_long(argc, argv, "b:Dd:HlmsS:vUwx", long_options, NULL))
+			!= -1)
 		switch (c)
 		{
+		case OPT_WATERFALL:
+			waterfall_range = optarg;
+			break;
+		case OPT_WF_STEP:
+			wf.step = atoi(optarg);
+			break;
+		case OPT_WF_THRESHOLD:
+			wf.threshold = atoi(optarg);
+			break;
+		case OPT_WF_DEPTH:
+			if ((wf.depth = atoi(optarg)) < 1)
+			{
+				fprintf(stderr, "--depth must be 1 or more.\n\n");
+				usage();
+				exit(1);
+			}
+			break;
+		case OPT_WF_COUNT:
+			wf.count = atol(optarg);
+			break;
+		case OPT_WF_BINARY:
+			wf.format = WATERFALL_BINARY;
+			break;
+		case 'w':
+		case OPT_WATCH:
+			flag_watch++;
+			if (optarg)
+				watch_deadband = atoi(optarg);
+			break;
+		case 'H':
+			if (rdpc101_set_backend(RDPC101_BACKEND_HIDRAW) < 0)
+			{
+				fprintf(stderr, "hidraw backend is not available.\n");
+				exit(1);
+			}
+			break;
+		case OPT_WATCH_ALL:
+			flag_watch_all++;
+			if (optarg)
+				watch_deadband = atoi(optarg);
+			break;
+		case OPT_SCHEDULE:
+			schedule_file = optarg;
+			break;
+		case OPT_MONITOR:
+			monitor_file = optarg;
+			break;
+		case OPT_INTERVAL:
+			if ((monitor_interval = atoi(optarg)) < 1)
+			{
+				fprintf(stderr, "--interval must be 1 or more.\n\n");
+				usage();
+				exit(1);
+			}
+			break;
+		case OPT_DROPOUT:
+			monitor_dropout = atoi(optarg);
+			break;
+		case OPT_ALARMS:
+			alarm_file = optarg;
+			break;
+		case OPT_ALARM_HOOK:
+			alarm_hook = optarg;
+			break;
+		case OPT_RECORDER:
+			if (rdpc101_recorder_open(optarg, RDPC101_RECORDER_SLOTS) < 0)
+			{
+				fprintf(stderr, "Cannot open recorder %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case OPT_ARCHIVE:
+			if (rdpc101_archive_open(optarg) < 0)
+			{
+				fprintf(stderr, "Cannot open archive %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case OPT_COARSE_SCAN:
+			switch (tolower(*optarg))
+			{
+			case 'a':
+				hs.band = RDPC_BAND_AM;
+				break;
+			case 'f':
+				hs.band = RDPC_BAND_FM;
+				break;
+			default:
+				fprintf(stderr, "invalid arg: %s\n", optarg);
+				usage();
+				exit(1);
+				break;
+			}
+			break;
+		case OPT_STRIDE:
+			if ((hs.stride = atoi(optarg)) < 1)
+			{
+				fprintf(stderr, "--stride must be 1 or more.\n\n");
+				usage();
+				exit(1);
+			}
+			break;
+		case OPT_FLOOR:
+			hs.floor = atoi(optarg);
+			break;
+		case OPT_MEMSCAN:
+			ms.path = optarg;
+			break;
+		case OPT_DWELL:
+			if ((ms.dwell_ms = atoi(optarg)) < 0)
+			{
+				fprintf(stderr, "--dwell require a non-negative time.\n\n");
+				usage();
+				exit(1);
+			}
+			wf.dwell_ms = ms.dwell_ms;
+			break;
+		case OPT_SQUELCH:
+			ms.squelch = atoi(optarg);
+			break;
+		case OPT_RT:
+			flag_rt++;
+			rt.lock_memory = TRUE;
+			if ((rt.priority = optarg ? atoi(optarg) : 50) < 1
+					|| rt.priority > 99)
+			{
+				fprintf(stderr, "--rt require a priority of 1 to 99.\n\n");
+				usage();
+				exit(1);
+			}
+			break;
+		case OPT_CPUS:
+			if ((rt.cpus = parse_cpus(optarg)) == 0)
+			{
+				fprintf(stderr, "invalid cpu list: %s\n", optarg);
+				usage();
+				exit(1);
+			}
+			break;
+		case OPT_POLL:
+			if ((poll_us = atol(optarg)) <= 0)
+			{
+				fprintf(stderr, "--poll require a positive period.\n\n");
+				usage();
+				exit(1);
+			}
+			flag_watch++;
+			break;
+		case OPT_MEASURE_TUNE:
+			if ((measure_repeat = optarg ? atoi(optarg) : 5) <= 0)
+			{
+				fprintf(stderr, "--measure-tune require a positive count.\n\n");
+				usage();
+				exit(1);
+			}
+			break;
+		case 'b':
+			batch_file = optarg;
+			break;
 		case 'D':
 			flag_seek = RDPC_SEEK_DOWN;
 			break;
@@ -146,7 +336,7 @@ int main(int argc, char **argv)
 			flag_seek = RDPC_SEEK_UP;
 			break;
 		case 'v':
-			flag_verbose++;
+			rdpc101_set_verbose(rdpc101_verbose() + 1);
 			break;
 		case 'x':
 			flag_expert++;
@@ -162,35 +352,28 @@ int main(int argc, char **argv)
 
 	if (argc > 0 && isdigit(**argv))
 	{
-		freq = atoi(*argv);
-		if (rdpc101_band(freq * 100) == RDPC_BAND_FM)
+		if ((freq = parse_freq(*argv, flag_expert, &flag_ma)) <= 0)
 		{
-			int step = rdpc101_step(freq * 100);
-
-			if (flag_expert)
-				freq = (int) (atof(*argv) * 100.0);
-			else
-				freq = (((int) (atof(*argv) * 100.0) + (step >> 1)) / step)
-						* step;
-			if (flag_ma == RDPC_MA_UNSPEC)
-				flag_ma = RDPC_MA_STEREO;
+			fprintf(stderr, "invalid freq range: %s\n", *argv);
+			exit(1);
 		}
-		else if (rdpc101_band(freq) == RDPC_BAND_AM)
-		{
-			int step = rdpc101_step(freq);
+	}
 
-			if (!flag_expert)
-				freq = ((freq + (step >> 1)) / step) * step;
-			if (flag_ma == RDPC_MA_UNSPEC)
-				flag_ma = RDPC_MA_MONO;
-		}
-		else
+	if (waterfall_range)
+	{
+		if (parse_freq_range(waterfall_range, flag_expert, &wf.freq_min,
+				&wf.freq_max) < 0)
 		{
-			fprintf(stderr, "invalid freq range: %s\n", *argv);
+			fprintf(stderr, "invalid waterfall range: %s\n", waterfall_range);
 			exit(1);
 		}
+		if (wf.step <= 0)
+			wf.step = rdpc101_step(wf.freq_min);
 	}
 
+	ms.expert = flag_expert;
+	ms.count = wf.count;
+
 	if ((dev_info = get_dev_info()) == NULL )
 	{
 		perror("make_dev_info");
@@ -219,6 +402,48 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
+	if ((flag_rt || rt.cpus) && rdpc101_rt_start(&rt) < 0)
+		perror("real-time mode");
+
+	if (batch_file)
+	{
+		ret = rdpc101_batch(rdpc101_list, dev_index, batch_file, flag_expert);
+		exit_if_cancelled();
+		rdpc101_cleanup(dev_info);
+		exit(ret < 0 ? 1 : 0);
+	}
+
+	if (flag_watch_all)
+	{
+		ret = rdpc101_watch_all(rdpc101_list, watch_deadband);
+		exit_if_cancelled();
+		rdpc101_cleanup(dev_info);
+		exit(ret < 0 ? 1 : 0);
+	}
+
+	if (monitor_file)
+	{
+		ret = rdpc101_monitor(rdpc101_list, monitor_file, monitor_interval,
+				monitor_dropout);
+		exit_if_cancelled();
+		rdpc101_cleanup(dev_info);
+		exit(ret < 0 ? 1 : 0);
+	}
+	if (alarm_file)
+	{
+		ret = rdpc101_alarm(rdpc101_list, alarm_file, alarm_hook, flag_expert);
+		exit_if_cancelled();
+		rdpc101_cleanup(dev_info);
+		exit(ret < 0 ? 1 : 0);
+	}
+	if (schedule_file)
+	{
+		ret = rdpc101_schedule(rdpc101_list, schedule_file, flag_expert);
+		exit_if_cancelled();
+		rdpc101_cleanup(dev_info);
+		exit(ret < 0 ? 1 : 0);
+	}
+
 	if (flag_list)
 	{
 		rdpc101_list_device(rdpc101_list);
@@ -228,6 +453,7 @@ int main(int argc, char **argv)
 		int ret;
 		if (rdpc101_update_state(rp) < 0)
 		{
+			exit_if_cancelled();
 			fprintf(stderr, "Cannot stat dev: %d\n", dev_index);
 			rdpc101_cleanup(dev_info);
 			exit(1);
@@ -238,6 +464,7 @@ int main(int argc, char **argv)
 	{
 		sigset_t prev_sigset;
 		enum rdpc_band band = rdpc101_band(freq);
+		int ofreq = rp->cur.freq;
 
 		if (band != rdpc101_band(rp->cur.freq)
 				&& rdpc101_set_band(rp, band) < 0)
@@ -247,20 +474,66 @@ int main(int argc, char **argv)
 			rdpc101_cleanup(dev_info);
 			exit(1);
 		}
-		if (freq != rp->cur.freq && rdpc101_set_freq(rp, freq) < 0)
+		if (freq != rp->cur.freq)
 		{
-			char freqstr[FREQSTR_MAX];
+			struct rdpc101_settle res;
+
+			prev_sigset = block_sigs();
+			ret = rdpc101_tune_settle(rp, freq, RDPC101_SETTLE_TOLERANCE,
+					RDPC101_TIMEOUT, &res);
+			unblock_sigs(prev_sigset);
+			if (ret < 0)
+			{
+				char freqstr[FREQSTR_MAX];
 
-			sstr_freq(freqstr, sizeof freqstr, freq);
-			fprintf(stderr, "Cannot set freq to %s\n", freqstr);
+				if (rdpc101_cancelled())
+				{
+					if (band != rdpc101_band(ofreq))
+						rdpc101_set_band(rp, rdpc101_band(ofreq));
+					rdpc101_set_freq(rp, ofreq);
+					exit_if_cancelled();
+				}
+				sstr_freq(freqstr, sizeof freqstr, freq);
+				fprintf(stderr, "Cannot set freq to %s\n", freqstr);
+				rdpc101_cleanup(dev_info);
+				exit(1);
+			}
+			if (res.lock_us < 0)
+			{
+				char freqstr[FREQSTR_MAX];
+
+				sstr_freq(freqstr, sizeof freqstr, freq);
+				fprintf(stderr, "Tuner did not lock to %s\n", freqstr);
+				rdpc101_cleanup(dev_info);
+				exit(1);
+			}
+			if (ret > 0)
+				Warn("RSSI did not settle within %d ms", RDPC101_TIMEOUT);
+			Notice("lock %ld us, settle %ld us", res.lock_us, res.settle_us);
+		}
+		display_freq(rp);
+		printf("  %3d\n", rp->cur.sig_intensity);
+	}
+	else if (flag_watch)
+	{
+		if ((poll_us > 0 ? rdpc101_watch_poll(rp, watch_deadband, poll_us,
+				wf.count) : rdpc101_watch_state(rp, watch_deadband)) < 0)
+		{
+			exit_if_cancelled();
+			fprintf(stderr, "Cannot watch dev: %d\n", dev_index);
+			rdpc101_cleanup(dev_info);
+			exit(1);
+		}
+	}
+	else if (measure_repeat > 0)
+	{
+		if (rdpc101_measure_tune(rp, measure_repeat) < 0)
+		{
+			exit_if_cancelled();
+			fprintf(stderr, "Cannot measure tune\n");
 			rdpc101_cleanup(dev_info);
 			exit(1);
 		}
-#if 1
-		prev_sigset = block_sigs();
-		rdpc101_display_seeking(rp);
-		unblock_sigs(prev_sigset);
-#endif
 	}
 	else if (flag_seek != RDPC_SEEK_UNSPEC)
 	{
@@ -275,6 +548,8 @@ int main(int argc, char **argv)
 		}
 		else
 		{
+			int ofreq = rp->cur.freq;
+
 			prev_sigset = block_sigs();
 			ret = rdpc101_mute(rp, RDPC_MUTE_ON);
 			if ((ret = rdpc101_seek(rp, flag_seek)) < 0)
@@ -283,15 +558,49 @@ int main(int argc, char **argv)
 				rdpc101_cleanup(dev_info);
 				exit(1);
 			}
-			rdpc101_display_seeking(rp);
+			/* retuning stops the seek where it is */
+			if (rdpc101_display_seeking(rp) < 0 && rdpc101_cancelled())
+				rdpc101_set_freq(rp, ofreq);
 			rdpc101_mute(rp, RDPC_MUTE_OFF);
 			unblock_sigs(prev_sigset);
+			exit_if_cancelled();
+		}
+	}
+	else if (waterfall_range)
+	{
+		if (rdpc101_waterfall(rp, &wf) < 0)
+		{
+			exit_if_cancelled();
+			fprintf(stderr, "Cannot run waterfall\n");
+			rdpc101_cleanup(dev_info);
+			exit(1);
+		}
+	}
+	else if (hs.band != RDPC_BAND_UNSPEC)
+	{
+		if (rdpc101_hscan(rp, &hs) < 0)
+		{
+			exit_if_cancelled();
+			fprintf(stderr, "Cannot scan\n");
+			rdpc101_cleanup(dev_info);
+			exit(1);
+		}
+	}
+	else if (ms.path)
+	{
+		if (rdpc101_memscan(rp, &ms) < 0)
+		{
+			exit_if_cancelled();
+			fprintf(stderr, "Cannot run memscan\n");
+			rdpc101_cleanup(dev_info);
+			exit(1);
 		}
 	}
 	else if (flag_scan != RDPC_BAND_UNSPEC)
 	{
-		if (rdpc101_scan(rp, flag_scan) < 0)
+		if (rdpc101_scan(rdpc101_list, rp, flag_scan) < 0)
 		{
+			exit_if_cancelled();
 			fprintf(stderr, "Cannot scan\n");
 			rdpc101_cleanup(dev_info);
 			exit(1);
@@ -308,7 +617,8 @@ int main(int argc, char **argv)
 void usage(void)
 {
 	fprintf(stderr, "Usage: %s [options] freq\n", program_name);
-	fprintf(stderr, "  -d dev_index\tspecify rdpc101#\n"
+	fprintf(stderr, "  -b file\trun commands from file (- for stdin)\n"
+			"  -d dev_index\tspecify rdpc101#\n"
 			"  -l\t\tlist rdpc101 devices\n"
 			"  -m\t\tmonaural\n"
 			"  -s\t\tstereo\n"
@@ -316,6 +626,48 @@ void usage(void)
 			"  -v\t\tincrement verbose level\n"
 			"  -D\t\tseek down\n"
 			"  -U\t\tseek up\n"
+			"  -H, --hidraw\tuse /dev/hidraw directly (Linux)\n"
+			"  -w, --watch[=n]\n"
+			"\t\tprint status changes; rssi deadband n (default: 2)\n"
+			"  --poll us\tlike --watch, reading on a fixed period; reports\n"
+			"\t\twakeup jitter\n"
+			"  --rt[=prio]\treal-time mode: SCHED_FIFO at prio (default: 50),\n"
+			"\t\tlocked memory\n"
+			"  --cpus list\trun on the listed CPUs, e.g. 0,2-3\n"
+			"  --watch-all[=n]\n"
+			"\t\tlike --watch for every device in one thread (needs -H)\n"
+			"  --waterfall am|fm|tv|min-max\n"
+			"\t\trepeatedly sweep the range, report RSSI changes\n"
+			"  --step n\twaterfall step (default: band step)\n"
+			"  --threshold n\tminimum RSSI change reported (default: 3)\n"
+			"  --depth n\tpeak-hold over the last n sweeps (default: 4)\n"
+			"  --count n\tstop after n waterfall sweeps, memscan passes or\n"
+			"\t\tpoll periods (default: forever)\n"
+			"  --binary\twrite binary records instead of ANSI rows\n"
+			"  --coarse-scan am|fm\n"
+			"\t\tscan coarsely, then refine around signals\n"
+			"  --stride n\tcoarse-scan stride in band steps (default: 4)\n"
+			"  --floor n\tcoarse-scan noise floor (default: estimated)\n"
+			"  --memscan file\tscan the channels listed in file (freq [weight]),\n"
+			"\t\theavier channels more often\n"
+			"  --dwell ms\tminimum memscan time per channel, and a quarter\n"
+			"\t\tof the waterfall lock wait (default: 50)\n"
+			"  --squelch n\tRSSI that holds the memscan (default: 30)\n"
+			"  --monitor file\tkeep per-station RSSI statistics of every device,\n"
+			"\t\tcheckpointed to file\n"
+			"  --interval n\tmonitor checkpoint interval in seconds (default: 60)\n"
+			"  --dropout n\tmonitor dropout level (default: 10)\n"
+			"  --alarms file\tevaluate the alarm rules in file on every device\n"
+			"  --alarm-hook cmd\n"
+			"\t\trun cmd on every alarm change\n"
+			"  --recorder file\trecord every report in a ring file for\n"
+			"\t\trdpc-recdump (default: $" RDPC101_RECORDER_ENV ")\n"
+			"  --archive file\tappend every report to a compressed archive\n"
+			"\t\tfor rdpc-archive\n"
+			"  --schedule file\n"
+			"\t\tretune devices at the times listed in file\n"
+			"  --measure-tune[=n]\n"
+			"\t\treport tune-to-settle times over n rounds (default: 5)\n"
 			"freq\t\t 900 ... am  900 Khz\n"
 			"\t\t86.0 ... fm 86.0 Mhz\n");
 }
@@ -329,10 +681,30 @@ get_dev_info(void)
 	return &dev_info;
 }
 
+static volatile sig_atomic_t caught_sig;
+
+/*
+ * Only async-signal-safe work here: cancel whatever is running and let
+ * it restore the tuner; a second signal exits at once.
+ */
 void rdpc101_sighand(int sig)
 {
+	if (caught_sig)
+		_exit(1);
+	caught_sig = sig;
+	rdpc101_cancel();
+}
+
+/*
+ * Call once an operation has returned: if a signal cancelled it, clean
+ * up and exit.
+ */
+void exit_if_cancelled(void)
+{
+	if (!rdpc101_cancelled())
+		return;
 	rdpc101_cleanup(get_dev_info());
-	fprintf(stderr, "\nCaught sig %d\n", sig);
+	fprintf(stderr, "\nCaught sig %d\n", (int) caught_sig);
 	exit(1);
 }
 
@@ -355,6 +727,72 @@ sstr_freq(char *buf, int size, int freq)
 	return buf;
 }
 
+/*
+ * "86.0" -> 8600 (FM, 10 kHz units), "954" -> 954 (AM, kHz).
+ * Rounds to the band step unless expert; sets *ma to the band default
+ * when it is still unspecified.  Returns 0 if out of range.
+ */
+int parse_freq(const char *s, int expert, enum rdpc_ma *ma)
+{
+	int freq = atoi(s);
+
+	if (rdpc101_band(freq * 100) == RDPC_BAND_FM)
+	{
+		int step = rdpc101_step(freq * 100);
+
+		if (expert)
+			freq = (int) (atof(s) * 100.0);
+		else
+			freq = (((int) (atof(s) * 100.0) + (step >> 1)) / step) * step;
+		if (ma && *ma == RDPC_MA_UNSPEC)
+			*ma = RDPC_MA_STEREO;
+	}
+	else if (rdpc101_band(freq) == RDPC_BAND_AM)
+	{
+		int step = rdpc101_step(freq);
+
+		if (!expert)
+			freq = ((freq + (step >> 1)) / step) * step;
+		if (ma && *ma == RDPC_MA_UNSPEC)
+			*ma = RDPC_MA_MONO;
+	}
+	else
+		return 0;
+	return freq;
+}
+
+/*
+ * "am", "fm", "tv" or "min-max" in parse_freq() notation.
+ * Both ends must be in the same band.
+ */
+int parse_freq_range(const char *s, int expert, int *freq_min, int *freq_max)
+{
+	const char *sep;
+	enum radio_freq_desc_index ind = RFD_ERROR;
+
+	if (strcasecmp(s, "am") == 0)
+		ind = RFD_AM;
+	else if (strcasecmp(s, "fm") == 0)
+		ind = RFD_FM;
+	else if (strcasecmp(s, "tv") == 0)
+		ind = RFD_TV;
+	if (ind != RFD_ERROR)
+	{
+		*freq_min = rdpc101_freq_min(ind);
+		*freq_max = rdpc101_freq_max(ind);
+		return 0;
+	}
+	if ((sep = strchr(s, '-')) == NULL)
+		return -1;
+	if ((*freq_min = parse_freq(s, expert, NULL)) <= 0
+			|| (*freq_max = parse_freq(sep + 1, expert, NULL)) <= 0)
+		return -1;
+	if (*freq_min > *freq_max
+			|| rdpc101_band(*freq_min) != rdpc101_band(*freq_max))
+		return -1;
+	return 0;
+}
+
 char const *
 str_ma(enum rdpc_ma ma)
 {
@@ -398,8 +836,8 @@ void set_signal_handlers(void)
 {
 	struct sigaction act;
 
+	/* no SA_RESTART: blocking calls return EINTR and see the cancel */
 	memset(&act, 0, sizeof act);
-	act.sa_flags = SA_RESTART;
 	act.sa_handler = rdpc101_sighand;
 	sigemptyset(&act.sa_mask);
 	sigaddset(&act.sa_mask, SIGINT);
@@ -411,16 +849,16 @@ void set_signal_handlers(void)
 	sigaction(SIGTERM, &act, NULL );
 }
 
+/*
+ * Hold off suspension while the tuner is muted or mid-sweep.  SIGINT,
+ * SIGQUIT and SIGTERM stay deliverable and cancel the operation.
+ */
 sigset_t block_sigs()
 {
 	sigset_t new, old;
 
-	memset(&new, 0, sizeof new);
-
+	sigemptyset(&new);
 	sigaddset(&new, SIGTSTP);
-	sigaddset(&new, SIGINT);
-	sigaddset(&new, SIGQUIT);
-	sigaddset(&new, SIGTERM);
 	sigprocmask(SIG_BLOCK, &new, &old);
 
 	return old;
@@ -447,88 +885,334 @@ void display_freq(struct rdpc101_dev *rp)
 	fflush(stdout);
 }
 
-void rdpc101_display_seeking(struct rdpc101_dev *rp)
+int rdpc101_display_seeking(struct rdpc101_dev *rp)
 {
-	struct timespec t = { 0, 200 * 1000 * 1000 };
+	uint64_t t0 = rdpc101_now_us();
 	int ret;
 	int tty = isatty(1);
 
-	do
+	for (;;)
 	{
-		if(tty)
+		if (tty)
 		{
 			putchar('\r');
 			display_freq(rp);
 		}
-		if (nanosleep(&t, NULL) != 0)
-		{
-			perror("nanosleep");
-			return;
-		}
-		ret = rdpc101_update_state(rp);
-	} while ((rp->cur.ma & RDPC_MA_SEEKING_MASK) && ret == 0);
-	if(ret)
-		Error("seek failed:(%d)", ret);
-	else
+		if ((ret = rdpc101_read_state(rp, -1)) < 0)
+			break;
+		/* the first reports may predate the seek */
+		if (ret > 0 && !(rp->cur.ma & RDPC_MA_SEEKING_MASK)
+				&& rdpc101_now_us() - t0 >= RDPC101_SEEK_SETTLE_US)
+			break;
+	}
+	if (ret < 0)
 	{
 		if (tty)
-			putchar('\r');
-		display_freq(rp);
-		printf("  %3d\n", rp->cur.sig_intensity);
+			putchar('\n');
+		if (errno != ECANCELED)
+			Error("seek failed:(%d)", ret);
+		return ret;
 	}
+	if (tty)
+		putchar('\r');
+	display_freq(rp);
+	printf("  %3d\n", rp->cur.sig_intensity);
+	return 0;
 }
 
-int rdpc101_scan(struct rdpc101_dev *rp, enum rdpc_band band)
+static void print_change(struct rdpc101_dev *rp, unsigned changes)
 {
-	int ofreq, freq;
-	int oband;
-	int ret;
 	char freqstr[FREQSTR_MAX];
-	int freq_min = rdpc101_freq_min(band == RDPC_BAND_AM ? RFD_AM : RFD_FM);
-	int freq_max = rdpc101_freq_max(band == RDPC_BAND_AM ? RFD_AM : RFD_FM);
+	struct timespec now;
+	char stamp[16];
 
-	ofreq = rp->cur.freq;
-	oband = rdpc101_band(ofreq);
+	clock_gettime(CLOCK_REALTIME, &now);
+	strftime(stamp, sizeof stamp, "%H:%M:%S", localtime(&now.tv_sec));
+	printf("%s.%03ld %2d %10s %-8s %3d%s%s%s%s%s\n", stamp,
+			now.tv_nsec / 1000000, rp->index,
+			sstr_freq(freqstr, sizeof freqstr, rp->cur.freq),
+			str_ma(rp->cur.ma & ~RDPC_MA_SEEKING_MASK),
+			rp->cur.sig_intensity,
+			(rp->cur.ma & RDPC_MA_SEEKING_MASK) ? " seeking" : "",
+			(changes & RDPC101_CHANGE_FREQ) ? " +freq" : "",
+			(changes & RDPC101_CHANGE_STEREO) ? " +ma" : "",
+			(changes & RDPC101_CHANGE_SEEKING) ? " +seek" : "",
+			(changes & RDPC101_CHANGE_SIGNAL) ? " +sig" : "");
+}
+
+/*
+ * Print one line per status change until interrupted.
+ */
+int rdpc101_watch_state(struct rdpc101_dev *rp, int deadband)
+{
+	int changes;
+
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	while ((changes = rdpc101_watch(rp, deadband, -1)) > 0)
+		print_change(rp, changes);
+	return changes;
+}
+
+static void watch_all_cb(struct rdpc101_dev *rp, void *arg)
+{
+	unsigned changes;
 
-	if (oband != band && (ret = rdpc101_set_band(rp, band)) < 0)
+	if ((changes = rdpc101_state_changed(rp, *(int *) arg)) != 0)
+		print_change(rp, changes);
+}
+
+/*
+ * --watch for every device, served by one epoll reactor.
+ */
+int rdpc101_watch_all(struct rdpc101_dev *list, int deadband)
+{
+	struct rdpc101_reactor *r;
+	struct rdpc101_dev *p;
+	int ret;
+
+	if ((r = rdpc101_reactor_new(watch_all_cb, &deadband)) == NULL)
 	{
-		Error("Cannot set band: %x", band);
-		return ret;
+		Error("Cannot create reactor");
+		return -1;
 	}
-	if ((ret = rdpc101_set_freq(rp, freq_min)) < 0)
+	for (p = list; p; p = p->next)
+		if (rdpc101_reactor_add(r, p) < 0)
+		{
+			Error("Cannot watch dev %d (hidraw backend required)", p->index);
+			rdpc101_reactor_free(r);
+			return -1;
+		}
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	ret = rdpc101_reactor_run(r, -1);
+	rdpc101_reactor_free(r);
+	return ret;
+}
+
+static void print_jitter(const struct rdpc101_jitter *j, int hist)
+{
+	int i;
+
+	fprintf(stderr, "%lu wakeups, late mean %.1f us, max %ld us, %lu overruns\n",
+			j->wakeups, j->wakeups ? (double) j->sum_us / j->wakeups : 0.0,
+			j->max_us, j->overruns);
+	if (!hist)
+		return;
+	for (i = 0; i < RDPC101_JITTER_BINS; i++)
+		if (j->hist[i])
+			fprintf(stderr, "  < %8ld us %10lu\n", 1L << i, j->hist[i]);
+}
+
+/*
+ * --watch on a fixed period_us wakeup, reporting how late the wakeups
+ * were every WATCH_POLL_REPORT_US and at the end.  j carries the
+ * schedule from one chunk to the next.
+ */
+int rdpc101_watch_poll(struct rdpc101_dev *rp, int deadband, long period_us,
+		long count)
+{
+	struct rdpc101_jitter j;
+	long chunk = WATCH_POLL_REPORT_US / period_us;
+	long n;
+	int ret = 0;
+
+	memset(&j, 0, sizeof j);
+	if (chunk < 1)
+		chunk = 1;
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	for (n = 0; count == 0 || n < count; n += chunk)
 	{
-		sstr_freq(freqstr, sizeof freqstr, freq_min);
-		Error("Cannot set freq to %s", freqstr);
-		return ret;
+		long todo = (count == 0 || count - n > chunk) ? chunk : count - n;
+
+		if ((ret = rdpc101_rt_poll(rp, period_us, todo, watch_all_cb,
+				&deadband, &j)) < 0)
+			break;
+		print_jitter(&j, FALSE);
 	}
-	for (freq = freq_min; freq < freq_max; freq = rp->cur.freq)
+	print_jitter(&j, TRUE);
+	return ret;
+}
+
+/*
+ * "0,2-3" to a CPU bit mask; 0 on a syntax error.
+ */
+unsigned long parse_cpus(const char *s)
+{
+	unsigned long mask = 0;
+	const unsigned bits = sizeof mask * 8;
+
+	while (*s)
 	{
-		sigset_t prev_sigs = block_sigs();
+		char *end;
+		unsigned long lo, hi;
 
-		rdpc101_mute(rp, RDPC_MUTE_ON);
-		if ((ret = rdpc101_seek(rp, RDPC_SEEK_UP)) < 0)
+		lo = hi = strtoul(s, &end, 10);
+		if (end == s)
+			return 0;
+		if (*end == '-')
 		{
-			Error("Cannot seek: UP");
-			return ret;
+			s = end + 1;
+			hi = strtoul(s, &end, 10);
+			if (end == s)
+				return 0;
 		}
-		rdpc101_display_seeking(rp);
-		rdpc101_mute(rp, RDPC_MUTE_OFF);
-		unblock_sigs(prev_sigs);
+		if (lo > hi || hi >= bits)
+			return 0;
+		for (; lo <= hi; lo++)
+			mask |= 1UL << lo;
+		if (*end == ',')
+			end++;
+		else if (*end)
+			return 0;
+		s = end;
 	}
+	return mask;
+}
+
+static int scan_print(struct rdpc101_dev *rp, enum rdpc101_scan_event ev,
+		void *arg)
+{
+	int tty = *(int *) arg;
 
-	if ((oband != band) && (ret = rdpc101_set_band(rp, oband)) < 0)
+	if (ev == RDPC101_SCAN_SEEKING)
 	{
-		Error("Cannot set band: %d", oband);
-		return ret;
+		if (tty)
+		{
+			putchar('\r');
+			display_freq(rp);
+		}
+		return 0;
+	}
+	if (tty)
+		putchar('\r');
+	display_freq(rp);
+	printf("  %3d\n", rp->cur.sig_intensity);
+	return 0;
+}
+
+struct scan_job {
+	pthread_t thread;
+	int started;
+	struct rdpc101_dev *rp;
+	enum radio_freq_desc_index ind[RFD_TV + 1];
+	int nind;
+	int found;
+	int ret;
+};
+
+static pthread_mutex_t scan_print_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int scan_print_locked(struct rdpc101_dev *rp,
+		enum rdpc101_scan_event ev, void *arg)
+{
+	int tty = FALSE;
+
+	if (ev == RDPC101_SCAN_SEEKING)
+		return 0;
+	pthread_mutex_lock(&scan_print_lock);
+	scan_print(rp, ev, &tty);
+	pthread_mutex_unlock(&scan_print_lock);
+	return 0;
+}
+
+static void *scan_job_run(void *arg)
+{
+	struct scan_job *job = arg;
+	int i;
+
+	for (i = 0; i < job->nind && job->ret >= 0; i++)
+	{
+		int n = rdpc101_scan_range(job->rp, rdpc101_freq_min(job->ind[i]),
+				rdpc101_freq_max(job->ind[i]), scan_print_locked, NULL);
+
+		if (n < 0)
+		{
+			job->ret = -1;
+			if (errno != ECANCELED)
+				Error("dev %d: scan %d-%d failed: %s", job->rp->index,
+					rdpc101_freq_min(job->ind[i]),
+					rdpc101_freq_max(job->ind[i]), strerror(errno));
+		}
+		else
+			job->found += n;
 	}
-	if ((ret = rdpc101_set_freq(rp, ofreq)) < 0)
+	return NULL;
+}
+
+/*
+ * Seek scan every rfd sub-band of band.  With more than one tuner the
+ * sub-bands are shared out, rp taking the first, and scanned at once.
+ */
+int rdpc101_scan(struct rdpc101_dev *list, struct rdpc101_dev *rp,
+		enum rdpc_band band)
+{
+	struct scan_job jobs[RFD_TV + 1];
+	enum radio_freq_desc_index ind;
+	struct rdpc101_dev *p = list;
+	int njobs = 0, nsub = 0, found = 0;
+	int tty = isatty(1);
+	sigset_t prev_sigs;
+	int ret = 0;
+	int i;
+
+	memset(jobs, 0, sizeof jobs);
+	for (ind = RFD_AM; ind <= RFD_TV; ind++)
 	{
-		char freqstr[FREQSTR_MAX];
+		struct scan_job *job;
 
-		sstr_freq(freqstr, sizeof freqstr, ofreq);
-		Error("Cannot set freq to %s", freqstr);
-		return ret;
+		if (rdpc101_band(rdpc101_freq_min(ind)) != band)
+			continue;
+		while (p && p == rp)
+			p = p->next;
+		if (njobs == 0 || p)
+		{
+			job = &jobs[njobs++];
+			job->rp = njobs == 1 ? rp : p;
+			if (njobs > 1)
+				p = p->next;
+		}
+		else
+			job = &jobs[nsub % njobs];
+		job->ind[job->nind++] = ind;
+		nsub++;
+	}
+
+	if (njobs == 1)
+	{
+		for (i = 0; i < jobs[0].nind; i++)
+		{
+			ind = jobs[0].ind[i];
+			if ((ret = rdpc101_scan_range(rp, rdpc101_freq_min(ind),
+					rdpc101_freq_max(ind), scan_print, &tty)) < 0)
+			{
+				if (errno != ECANCELED)
+					Error("scan failed: %s", strerror(errno));
+				return ret;
+			}
+			found += ret;
+		}
+		Notice("%d stations", found);
+		return 0;
+	}
+
+	/* a signal cancels every job through rdpc101_cancel() */
+	prev_sigs = block_sigs();
+	for (i = 0; i < njobs; i++)
+		jobs[i].started = pthread_create(&jobs[i].thread, NULL, scan_job_run,
+				&jobs[i]) == 0;
+	/* no thread to spare: scan those sub-bands here */
+	for (i = 0; i < njobs; i++)
+		if (!jobs[i].started)
+			scan_job_run(&jobs[i]);
+	for (i = 0; i < njobs; i++)
+	{
+		if (jobs[i].started)
+			pthread_join(jobs[i].thread, NULL);
+		if (jobs[i].ret < 0)
+			ret = -1;
+		found += jobs[i].found;
 	}
+	unblock_sigs(prev_sigs);
+	Notice("%d stations on %d tuners", found, njobs);
 	return ret;
 }
 
@@ -3,6 +3,7 @@
  */
 #if !defined(__RDPC101_H)
 #define __RDPC101_H
+#include <stdint.h>
 #include <hidapi.h>
 
 #if !defined __RCSID
@@ -18,6 +19,14 @@
 #endif
 
 #define RDPC101_TIMEOUT 3000
+#define RDPC101_CANCEL_SLICE_MS 20	/* longest wait between cancel checks */
+#define RDPC101_REPORT_SIZE 3
+#define RDPC101_SERIAL_MAX 64
+#define RDPC101_REPORT_BUF 64	/* largest full-speed HID report */
+#define RDPC101_TUNE_TRIES 20
+#define RDPC101_SETTLE_REPORTS 3	/* consecutive reports compared */
+#define RDPC101_SETTLE_TOLERANCE 1
+#define RDPC101_SEEK_SETTLE_US 200000	/* reports before may predate a seek */
 
 /*
  * RDPC101 HID cmd etc
@@ -103,12 +112,95 @@ struct rdpc_state {
     int freq;
 };
 
+enum rdpc101_change {
+    RDPC101_CHANGE_FREQ = 1 << 0,
+    RDPC101_CHANGE_STEREO = 1 << 1,
+    RDPC101_CHANGE_SEEKING = 1 << 2,
+    RDPC101_CHANGE_SIGNAL = 1 << 3,
+    RDPC101_CHANGE_ALL = (1 << 4) - 1
+};
+
+/*
+ * command queue (librdpc101-queue.c)
+ */
+enum rdpc101_qcmd {
+    RDPC101_Q_BAND = 0,
+    RDPC101_Q_FREQ,
+    RDPC101_Q_MA,
+    RDPC101_Q_MUTE,
+    RDPC101_Q_NCMDS
+};
+
+struct rdpc101_queue_stats {
+    unsigned long submitted;
+    unsigned long coalesced;	/* replaced before being sent */
+    unsigned long sent;
+    unsigned long failed;
+};
+
+struct rdpc101_cmdq;
+
+enum rdpc101_backend {
+    RDPC101_BACKEND_HIDAPI = 0,
+    RDPC101_BACKEND_HIDRAW		/* Linux /dev/hidrawN */
+};
+
+/*
+ * real-time mode (librdpc101-rt.c)
+ */
+#define RDPC101_JITTER_BINS	24	/* log2 buckets of wakeup lateness, us */
+
+struct rdpc101_rt {
+    unsigned long cpus;		/* affinity, bit n = CPU n; 0 = unchanged */
+    int priority;		/* SCHED_FIFO priority; 0 = unchanged */
+    int lock_memory;		/* mlockall and prefault the stack */
+};
+
+struct rdpc101_jitter {
+    unsigned long wakeups;
+    unsigned long overruns;	/* periods skipped by late wakeups */
+    long max_us;
+    uint64_t sum_us;
+    unsigned long hist[RDPC101_JITTER_BINS];	/* hist[n]: < 2^n us late */
+    uint64_t next_ns;		/* last wakeup target; 0 starts a new period */
+};
+
+/*
+ * flight recorder (librdpc101-recorder.c)
+ */
+#define RDPC101_RECORDER_ENV	"RDPC101_RECORDER"	/* default ring file */
+#define RDPC101_RECORDER_SLOTS	4096
+
+/*
+ * anomaly logging (librdpc101-log.c)
+ */
+#define RDPC101_LOG_RATE	5	/* records per second per device */
+#define RDPC101_LOG_BURST	10
+
+struct rdpc101_log_state {
+    unsigned long anomalies;	/* every anomalous packet, logged or not */
+    unsigned long repeats;	/* folded into the previous record */
+    unsigned long suppressed;	/* dropped by the rate limit */
+    unsigned tokens;
+    uint64_t stamp_ms;
+    uint32_t last_hash;
+    int last_size;
+};
+
 struct rdpc101_dev {
     struct rdpc101_dev *next;
+    int index;			/* position in the device list */
     struct hid_device_info* dev;
     hid_device* handle;
+    enum rdpc101_backend backend;
+    int fd;			/* hidraw backend */
+    unsigned char rbuf[RDPC101_REPORT_BUF];
+    int rlen;			/* bytes of the last report in rbuf */
     struct rdpc_state prev;
     struct rdpc_state cur;
+    enum rdpc_mute mute;	/* last one set through rdpc101_mute() */
+    struct rdpc101_cmdq *cmdq;
+    struct rdpc101_log_state log;
 };
 
 struct radio_freq_desc {
@@ -118,29 +210,121 @@ struct radio_freq_desc {
     int step;
 };
 
+struct rdpc101_settle {
+    long lock_us;		/* until a report showed the new freq */
+    long settle_us;		/* until sig_intensity converged, -1 if not */
+    int reports;		/* status reports read */
+    int sig_intensity;
+};
+
+/*
+ * epoll reactor (librdpc101-reactor.c), hidraw backend only
+ */
+struct rdpc101_reactor;
+typedef void (*rdpc101_status_cb)(struct rdpc101_dev *rp, void *arg);
+
+#define RDPC101_STATE_HOOKS	4	/* rdpc101_add_state_hook() slots */
+
+/*
+ * seek scan session (librdpc101-scan.c)
+ */
+enum rdpc101_scan_event {
+    RDPC101_SCAN_SEEKING,	/* status report while seeking */
+    RDPC101_SCAN_FOUND		/* tuner stopped on a station in rp->cur */
+};
+typedef int (*rdpc101_scan_cb)(struct rdpc101_dev *rp,
+		enum rdpc101_scan_event ev, void *arg);
+
 struct dev_info {
     struct hid_device_info* devs;
     struct rdpc101_dev *rp;
 };
 
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
 int error_hidapi(const char *label, hid_device* device);
 void rdpc101_cleanup(struct dev_info *dev_info);
 enum rdpc_band rdpc101_band(int freq);
 enum radio_freq_desc_index rdpc101_band_index(int freq);
 struct rdpc101_dev *rdpc101_device(struct rdpc101_dev *rp, int index);
+struct rdpc101_dev *rdpc101_device_by_serial(struct rdpc101_dev *rp,
+		const char *serial);
 struct rdpc101_dev *rdpc101_get_list(struct dev_info *dip);
+int rdpc101_set_backend(enum rdpc101_backend backend);
+int rdpc101_open(struct rdpc101_dev *rp);
+void rdpc101_close(struct rdpc101_dev *rp);
+int rdpc101_fileno(struct rdpc101_dev *rp);
 int rdpc101_update_state(struct rdpc101_dev *rp);
+int rdpc101_add_state_hook(rdpc101_status_cb cb, void *arg);
+void rdpc101_del_state_hook(rdpc101_status_cb cb, void *arg);
+int rdpc101_decode_state(struct rdpc101_dev *rp, unsigned char *packet,
+		int size);
+int rdpc101_read_state(struct rdpc101_dev *rp, int timeout_ms);
+void rdpc101_cancel(void);
+int rdpc101_cancelled(void);
+void rdpc101_cancel_reset(void);
+unsigned rdpc101_state_diff(const struct rdpc_state *a,
+		const struct rdpc_state *b, int deadband);
+unsigned rdpc101_state_changed(struct rdpc101_dev *rp, int deadband);
+int rdpc101_watch(struct rdpc101_dev *rp, int deadband, int timeout_ms);
 int rdpc101_set_report(struct rdpc101_dev *rp, unsigned char *data, int data_size);
+void rdpc101_build_report(unsigned char *packet, enum rdpc_cmd cmd, int value);
 int rdpc101_set_ma(struct rdpc101_dev *rp, enum rdpc_ma ma);
 int rdpc101_mute(struct rdpc101_dev *rp, enum rdpc_mute mute);
 int rdpc101_set_band(struct rdpc101_dev *rp, enum rdpc_band band);
 int rdpc101_set_freq(struct rdpc101_dev *rp, int freq);
 int rdpc101_seek(struct rdpc101_dev *rp, enum rdpc_seek seek_dir);
+int rdpc101_tune_sample(struct rdpc101_dev *rp, int freq, int timeout_ms);
+int rdpc101_tune_settle(struct rdpc101_dev *rp, int freq, int tolerance,
+		int timeout_ms, struct rdpc101_settle *res);
+uint64_t rdpc101_now_us(void);
 int rdpc101_step(int freq);
 int rdpc101_freq_min(enum radio_freq_desc_index i);
 int rdpc101_freq_max(enum radio_freq_desc_index i);
+int rdpc101_scan_range(struct rdpc101_dev *rp, int freq_min, int freq_max,
+		rdpc101_scan_cb cb, void *arg);
 int rdpc101_claim_hid(struct rdpc101_dev *rp);
 int rdpc101_release_hid(struct rdpc101_dev *rp);
+
+void rdpc101_set_verbose(int level);
+int rdpc101_verbose(void);
+void rdpc101_log_packet(struct rdpc101_dev *rp, const char *label,
+		const unsigned char *p, int size);
+void rdpc101_log_flush(struct rdpc101_dev *rp);
+void rdpc101_log_stop(void);
+
+int rdpc101_recorder_open(const char *path, unsigned nslots);
+void rdpc101_recorder_close(void);
+
+int rdpc101_archive_open(const char *path);
+void rdpc101_archive_close(void);
+
+struct rdpc101_reactor *rdpc101_reactor_new(rdpc101_status_cb cb, void *arg);
+void rdpc101_reactor_free(struct rdpc101_reactor *r);
+int rdpc101_reactor_add(struct rdpc101_reactor *r, struct rdpc101_dev *rp);
+int rdpc101_reactor_submit(struct rdpc101_reactor *r, struct rdpc101_dev *rp,
+		enum rdpc_cmd cmd, int value);
+void rdpc101_reactor_stop(struct rdpc101_reactor *r);
+int rdpc101_reactor_run(struct rdpc101_reactor *r, int timeout_ms);
+
+int rdpc101_queue_start(struct rdpc101_dev *rp);
+void rdpc101_queue_stop(struct rdpc101_dev *rp);
+int rdpc101_queue_submit(struct rdpc101_dev *rp, enum rdpc101_qcmd cmd,
+		int value);
+int rdpc101_queue_flush(struct rdpc101_dev *rp);
+int rdpc101_queue_stats(struct rdpc101_dev *rp,
+		struct rdpc101_queue_stats *stats);
+
+int rdpc101_rt_start(const struct rdpc101_rt *rt);
+int rdpc101_rt_thread(void);
+int rdpc101_rt_poll(struct rdpc101_dev *rp, long period_us, long count,
+		rdpc101_status_cb cb, void *arg, struct rdpc101_jitter *j);
+
+#if defined(__cplusplus)
+}
+#endif
 #endif
 
 /*- 
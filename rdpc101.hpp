@@ -0,0 +1,697 @@
+/*
+ * C++20 interface to librdpc101, header only.
+ *
+ *	rdpc101::context ctx;			// hid_init + device list
+ *	auto dev = ctx.open(0);
+ *	rdpc101::event_loop loop;
+ *	auto st = loop.run(loop.tune_settle(dev, 8000));
+ *
+ * context and device are move-only owners of the list and of a device
+ * handle; devices must be destroyed before their context.  Seek,
+ * tune-and-settle and scan are coroutines that suspend until the next
+ * status report of their device, so one thread can drive any number of
+ * tuners from an event_loop.  Devices with a file descriptor (hidraw
+ * backend) are waited for with epoll; hidapi devices are polled every
+ * poll_ms while something waits on them.
+ */
+#if !defined(__RDPC101_HPP)
+#define __RDPC101_HPP
+
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "rdpc101.h"
+
+namespace rdpc101 {
+
+class error : public std::runtime_error
+{
+public:
+	using std::runtime_error::runtime_error;
+};
+
+class device
+{
+public:
+	device() noexcept = default;
+	explicit device(rdpc101_dev *rp) noexcept : rp_(rp) {}
+	device(device &&o) noexcept : rp_(std::exchange(o.rp_, nullptr)) {}
+	device &operator=(device &&o) noexcept
+	{
+		if (this != &o)
+		{
+			reset();
+			rp_ = std::exchange(o.rp_, nullptr);
+		}
+		return *this;
+	}
+	device(const device &) = delete;
+	device &operator=(const device &) = delete;
+	~device() { reset(); }
+
+	/* close the handle; the list node stays with the context */
+	void reset() noexcept
+	{
+		if (rp_)
+			rdpc101_close(rp_);
+		rp_ = nullptr;
+	}
+
+	rdpc101_dev *get() const noexcept { return rp_; }
+	explicit operator bool() const noexcept { return rp_ != nullptr; }
+	int index() const noexcept { return rp_->index; }
+	const rdpc_state &state() const noexcept { return rp_->cur; }
+	int fileno() const noexcept { return rdpc101_fileno(rp_); }
+
+	/* the last raw input report, valid until the next read */
+	std::span<const unsigned char> report() const noexcept
+	{
+		return { rp_->rbuf, static_cast<size_t>(rp_->rlen) };
+	}
+
+	void send(std::span<const unsigned char> report) const
+	{
+		/* rdpc101_set_report() does not write to the buffer */
+		check(rdpc101_set_report(rp_, const_cast<unsigned char *>(
+				report.data()), static_cast<int>(report.size())), "send");
+	}
+	void set_freq(int freq) const
+	{
+		check(rdpc101_set_freq(rp_, freq), "set_freq");
+	}
+	void set_band(rdpc_band band) const
+	{
+		check(rdpc101_set_band(rp_, band), "set_band");
+	}
+	void set_ma(rdpc_ma ma) const { check(rdpc101_set_ma(rp_, ma), "set_ma"); }
+	void mute(rdpc_mute m) const { check(rdpc101_mute(rp_, m), "mute"); }
+	void seek(rdpc_seek dir) const { check(rdpc101_seek(rp_, dir), "seek"); }
+
+	/* blocking read; false on timeout */
+	bool read_state(int timeout_ms = -1) const
+	{
+		return check(rdpc101_read_state(rp_, timeout_ms), "read_state") > 0;
+	}
+
+private:
+	static int check(int ret, const char *what)
+	{
+		if (ret < 0)
+			throw error(what);
+		return ret;
+	}
+
+	rdpc101_dev *rp_ = nullptr;
+};
+
+class context
+{
+public:
+	context()
+	{
+		if (hid_init() < 0)
+			throw error("hid_init");
+		if (rdpc101_get_list(&info_) == nullptr)
+		{
+			rdpc101_cleanup(&info_);
+			throw error("no RDPC101 found");
+		}
+		live_ = true;
+	}
+	context(context &&o) noexcept
+		: info_(o.info_), live_(std::exchange(o.live_, false)) {}
+	context &operator=(context &&o) noexcept
+	{
+		if (this != &o)
+		{
+			if (live_)
+				rdpc101_cleanup(&info_);
+			info_ = o.info_;
+			live_ = std::exchange(o.live_, false);
+		}
+		return *this;
+	}
+	context(const context &) = delete;
+	context &operator=(const context &) = delete;
+	~context()
+	{
+		if (live_)
+			rdpc101_cleanup(&info_);
+	}
+
+	device open(int index)
+	{
+		rdpc101_dev *rp = rdpc101_device(info_.rp, index);
+
+		if (rp == nullptr)
+			throw error("no such device");
+		if (rdpc101_open(rp) < 0)
+			throw error("open");
+		if (rp->cur.ma == RDPC_MA_UNSPEC && rdpc101_update_state(rp) < 0)
+			throw error("read_state");
+		return device(rp);
+	}
+
+	std::vector<device> open_all()
+	{
+		std::vector<device> v;
+
+		for (rdpc101_dev *rp = info_.rp; rp; rp = rp->next)
+			v.push_back(open(rp->index));
+		return v;
+	}
+
+private:
+	dev_info info_ {};
+	bool live_ = false;
+};
+
+/*
+ * Lazily started coroutine; co_await it, or hand it to event_loop.
+ */
+template <typename T = void>
+class task;
+
+namespace detail {
+
+struct promise_base
+{
+	std::coroutine_handle<> cont;
+	std::exception_ptr exc;
+
+	struct final_awaiter
+	{
+		bool await_ready() noexcept { return false; }
+		template <typename P>
+		std::coroutine_handle<> await_suspend(
+				std::coroutine_handle<P> h) noexcept
+		{
+			if (h.promise().cont)
+				return h.promise().cont;
+			return std::noop_coroutine();
+		}
+		void await_resume() noexcept {}
+	};
+
+	std::suspend_always initial_suspend() noexcept { return {}; }
+	final_awaiter final_suspend() noexcept { return {}; }
+	void unhandled_exception() noexcept { exc = std::current_exception(); }
+};
+
+template <typename T>
+struct promise : promise_base
+{
+	std::optional<T> value;
+
+	task<T> get_return_object() noexcept;
+	void return_value(T v) { value.emplace(std::move(v)); }
+	T result()
+	{
+		if (exc)
+			std::rethrow_exception(exc);
+		return std::move(*value);
+	}
+};
+
+template <>
+struct promise<void> : promise_base
+{
+	task<void> get_return_object() noexcept;
+	void return_void() noexcept {}
+	void result()
+	{
+		if (exc)
+			std::rethrow_exception(exc);
+	}
+};
+
+} /* namespace detail */
+
+template <typename T>
+class task
+{
+public:
+	using promise_type = detail::promise<T>;
+	using handle = std::coroutine_handle<promise_type>;
+
+	explicit task(handle h) noexcept : h_(h) {}
+	task(task &&o) noexcept : h_(std::exchange(o.h_, {})) {}
+	task &operator=(task &&o) noexcept
+	{
+		if (this != &o)
+		{
+			if (h_)
+				h_.destroy();
+			h_ = std::exchange(o.h_, {});
+		}
+		return *this;
+	}
+	task(const task &) = delete;
+	task &operator=(const task &) = delete;
+	~task()
+	{
+		if (h_)
+			h_.destroy();
+	}
+
+	auto operator co_await() && noexcept
+	{
+		struct awaiter
+		{
+			handle h;
+
+			bool await_ready() noexcept { return false; }
+			std::coroutine_handle<> await_suspend(
+					std::coroutine_handle<> cont) noexcept
+			{
+				h.promise().cont = cont;
+				return h;
+			}
+			T await_resume() { return h.promise().result(); }
+		};
+		return awaiter { h_ };
+	}
+
+private:
+	handle h_;
+};
+
+template <typename T>
+inline task<T> detail::promise<T>::get_return_object() noexcept
+{
+	return task<T>(std::coroutine_handle<promise<T>>::from_promise(*this));
+}
+
+inline task<void> detail::promise<void>::get_return_object() noexcept
+{
+	return task<void>(std::coroutine_handle<promise<void>>::from_promise(*this));
+}
+
+struct station
+{
+	int freq;
+	int sig_intensity;
+};
+
+class event_loop
+{
+	struct waiter
+	{
+		rdpc101_dev *rp;
+		uint64_t deadline;		/* 0: none */
+		std::coroutine_handle<> h;
+		bool got_report = false;
+	};
+
+	/* resumes with true on the next report of d, false on timeout */
+	struct report_awaiter : waiter
+	{
+		event_loop *loop;
+
+		bool await_ready() noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> h)
+		{
+			this->h = h;
+			loop->add(this);
+		}
+		bool await_resume() noexcept { return this->got_report; }
+	};
+
+	/* keeps a spawned task alive until it finishes */
+	struct detached
+	{
+		struct promise_type
+		{
+			detached get_return_object() noexcept { return {}; }
+			std::suspend_never initial_suspend() noexcept { return {}; }
+			std::suspend_never final_suspend() noexcept { return {}; }
+			void return_void() noexcept {}
+			void unhandled_exception() noexcept { std::terminate(); }
+		};
+	};
+
+public:
+	static constexpr int poll_ms = 10;	/* hidapi devices */
+	static constexpr uint64_t seek_settle_us = RDPC101_SEEK_SETTLE_US;
+
+	event_loop()
+	{
+		if ((epfd_ = epoll_create1(EPOLL_CLOEXEC)) < 0)
+			throw error("epoll_create1");
+	}
+	event_loop(const event_loop &) = delete;
+	event_loop &operator=(const event_loop &) = delete;
+	~event_loop() { close(epfd_); }
+
+	report_awaiter next_report(const device &d, int timeout_ms = -1)
+	{
+		report_awaiter a;
+
+		a.rp = d.get();
+		a.deadline = timeout_ms < 0 ? 0
+				: rdpc101_now_us() + static_cast<uint64_t>(timeout_ms) * 1000;
+		a.h = nullptr;
+		a.loop = this;
+		return a;
+	}
+
+	/* seek, and return the state the tuner stopped on */
+	task<rdpc_state> seek(const device &d, rdpc_seek dir,
+			int timeout_ms = 10000)
+	{
+		uint64_t t0 = rdpc101_now_us();
+		bool seen_seeking = false;
+
+		d.seek(dir);
+		for (;;)
+		{
+			if (!co_await next_report(d, remaining(t0, timeout_ms)))
+				throw error("seek timed out");
+			if (d.state().ma & RDPC_MA_SEEKING_MASK)
+				seen_seeking = true;
+			else if (seen_seeking || rdpc101_now_us() - t0 >= seek_settle_us)
+				co_return d.state();
+		}
+	}
+
+	/* same rules as rdpc101_tune_settle(); settle_us < 0 on timeout */
+	task<rdpc101_settle> tune_settle(const device &d, int freq,
+			int tolerance = RDPC101_SETTLE_TOLERANCE,
+			int timeout_ms = RDPC101_TIMEOUT)
+	{
+		rdpc101_settle res { -1, -1, 0, -1 };
+		int window[RDPC101_SETTLE_REPORTS];
+		int nwin = 0;
+		uint64_t t0 = rdpc101_now_us();
+
+		d.set_freq(freq);
+		while (co_await next_report(d, remaining(t0, timeout_ms)))
+		{
+			const rdpc_state &st = d.state();
+
+			res.reports++;
+			if (st.freq != freq || (st.ma & RDPC_MA_SEEKING_MASK))
+			{
+				nwin = 0;
+				continue;
+			}
+			if (res.lock_us < 0)
+				res.lock_us = rdpc101_now_us() - t0;
+			window[nwin++ % RDPC101_SETTLE_REPORTS] = st.sig_intensity;
+			if (nwin < RDPC101_SETTLE_REPORTS)
+				continue;
+			auto [lo, hi] = std::minmax_element(window,
+					window + RDPC101_SETTLE_REPORTS);
+			if (*hi - *lo <= tolerance)
+			{
+				res.settle_us = rdpc101_now_us() - t0;
+				res.sig_intensity = st.sig_intensity;
+				break;
+			}
+		}
+		co_return res;
+	}
+
+	/*
+	 * Seek up through [freq_min, freq_max] like rdpc101_scan_range():
+	 * muted throughout, band, frequency and mute restored at the end.
+	 */
+	task<std::vector<station>> scan(const device &d, int freq_min,
+			int freq_max)
+	{
+		std::vector<station> found;
+		std::exception_ptr exc;
+		rdpc_band band = rdpc101_band(freq_min);
+		int ofreq = d.state().freq;
+		rdpc_band oband = rdpc101_band(ofreq);
+		rdpc_mute omute = d.get()->mute;
+
+		try
+		{
+			d.mute(RDPC_MUTE_ON);
+			if (oband != band)
+				d.set_band(band);
+			rdpc101_settle s = co_await tune_settle(d, freq_min);
+			if (s.lock_us < 0)
+				throw error("band switch did not take");
+			while (d.state().freq < freq_max)
+			{
+				int last = d.state().freq;
+				rdpc_state st = co_await seek(d, RDPC_SEEK_UP);
+
+				if (st.freq <= last || st.freq > freq_max)
+					break;
+				found.push_back({ st.freq, st.sig_intensity });
+			}
+		}
+		catch (...)
+		{
+			exc = std::current_exception();
+		}
+		if (oband != band)
+			rdpc101_set_band(d.get(), oband);
+		rdpc101_set_freq(d.get(), ofreq);
+		rdpc101_mute(d.get(), omute);
+		if (exc)
+			std::rethrow_exception(exc);
+		co_return found;
+	}
+
+	/* start t now; it runs whenever the loop runs */
+	void spawn(task<void> t)
+	{
+		live_++;
+		start(std::move(t));
+	}
+
+	/* serve until every spawned task has finished */
+	void run()
+	{
+		while (live_ > 0)
+			step();
+		if (exc_)
+			std::rethrow_exception(std::exchange(exc_, nullptr));
+	}
+
+	template <typename T>
+	T run(task<T> t)
+	{
+		std::optional<T> result;
+
+		spawn(store(std::move(t), result));
+		run();
+		return std::move(*result);
+	}
+
+private:
+	static int remaining(uint64_t t0, int timeout_ms)
+	{
+		uint64_t spent = (rdpc101_now_us() - t0) / 1000;
+
+		if (timeout_ms < 0)
+			return -1;
+		return spent >= static_cast<uint64_t>(timeout_ms) ? 0
+				: timeout_ms - static_cast<int>(spent);
+	}
+
+	template <typename T>
+	static task<void> store(task<T> t, std::optional<T> &out)
+	{
+		out.emplace(co_await std::move(t));
+	}
+
+	detached start(task<void> t)
+	{
+		try
+		{
+			co_await std::move(t);
+		}
+		catch (...)
+		{
+			if (!exc_)
+				exc_ = std::current_exception();
+		}
+		live_--;
+	}
+
+	bool has_waiter(rdpc101_dev *rp) const
+	{
+		return std::find_if(waiters_.begin(), waiters_.end(),
+				[rp](const waiter *w) { return w->rp == rp; })
+				!= waiters_.end();
+	}
+
+	/*
+	 * A device's fd is in the epoll set only while something waits on
+	 * it; an entry left with the same fd belongs to a closed device.
+	 */
+	void add(waiter *w)
+	{
+		int fd = rdpc101_fileno(w->rp);
+
+		if (fd >= 0 && std::find(regs_.begin(), regs_.end(),
+				std::make_pair(w->rp, fd)) == regs_.end())
+		{
+			epoll_event ev {};
+
+			std::erase_if(regs_, [w, fd](const auto &r) {
+				return r.first == w->rp || r.second == fd;
+			});
+			ev.events = EPOLLIN;
+			ev.data.ptr = w->rp;
+			if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) < 0
+					&& errno != EEXIST)
+				throw error("epoll_ctl");
+			regs_.emplace_back(w->rp, fd);
+		}
+		waiters_.push_back(w);
+	}
+
+	/* drop the fds of served devices nothing waits on any more */
+	void prune(const std::vector<rdpc101_dev *> &served)
+	{
+		for (rdpc101_dev *rp : served)
+		{
+			if (has_waiter(rp))
+				continue;
+			for (auto it = regs_.begin(); it != regs_.end();)
+				if (it->first == rp)
+				{
+					/* a closed fd has already left the set */
+					if (rp->fd == it->second)
+						epoll_ctl(epfd_, EPOLL_CTL_DEL, it->second, nullptr);
+					it = regs_.erase(it);
+				}
+				else
+					++it;
+		}
+	}
+
+	/*
+	 * Read rp's queued reports one at a time, resuming its waiters
+	 * after each, so none of them misses a report.
+	 */
+	void serve(rdpc101_dev *rp, std::vector<rdpc101_dev *> &served)
+	{
+		served.push_back(rp);
+		while (has_waiter(rp) && rdpc101_read_state(rp, 0) > 0)
+		{
+			std::vector<waiter *> ready;
+
+			for (auto it = waiters_.begin(); it != waiters_.end();)
+				if ((*it)->rp == rp)
+				{
+					(*it)->got_report = true;
+					ready.push_back(*it);
+					it = waiters_.erase(it);
+				}
+				else
+					++it;
+			for (waiter *w : ready)
+				w->h.resume();
+		}
+	}
+
+	void step()
+	{
+		epoll_event events[16];
+		std::vector<rdpc101_dev *> served;
+		std::vector<waiter *> expired;
+		uint64_t now = rdpc101_now_us();
+		int wait = -1;
+		int n;
+
+		for (waiter *w : waiters_)
+		{
+			if (w->rp->fd < 0)
+				wait = wait < 0 ? poll_ms : std::min(wait, poll_ms);
+			if (w->deadline)
+			{
+				int ms = w->deadline > now
+						? static_cast<int>((w->deadline - now + 999) / 1000) : 0;
+
+				wait = wait < 0 ? ms : std::min(wait, ms);
+			}
+		}
+		if ((n = epoll_wait(epfd_, events, 16, wait)) < 0 && errno != EINTR)
+			throw error("epoll_wait");
+		for (int i = 0; i < n; i++)
+			serve(static_cast<rdpc101_dev *>(events[i].data.ptr), served);
+
+		std::vector<rdpc101_dev *> polled;
+		for (waiter *w : std::vector<waiter *>(waiters_))
+			if (w->rp->fd < 0
+					&& std::find(polled.begin(), polled.end(), w->rp)
+							== polled.end())
+			{
+				polled.push_back(w->rp);
+				serve(w->rp, served);
+			}
+
+		now = rdpc101_now_us();
+		for (auto it = waiters_.begin(); it != waiters_.end();)
+			if ((*it)->deadline && (*it)->deadline <= now)
+			{
+				served.push_back((*it)->rp);
+				expired.push_back(*it);
+				it = waiters_.erase(it);
+			}
+			else
+				++it;
+		for (waiter *w : expired)
+			w->h.resume();
+		prune(served);
+	}
+
+	int epfd_ = -1;
+	int live_ = 0;
+	std::exception_ptr exc_;
+	std::vector<std::pair<rdpc101_dev *, int>> regs_;
+	std::vector<waiter *> waiters_;
+};
+
+} /* namespace rdpc101 */
+
+#endif
+
+/*-
+ * Copyright (c) 2009 NISHIO Yasuhiro <nishio@hh.iij4u.or.jp>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */